@@ -2,171 +2,261 @@
 
 #include <queue>
 #include <vector>
-#include <unordered_map>
 #include <list>
+#include <math.h>
+#include <string.h>
 
 #include "priority-queue.h"
 #include "proc-gen.h"
+#include "grid.h"
+#include "landmarks.h"
+#include "flowfield.h"
+#include "path-cache.h"
+#include "grid-search.h"
 
 // Basing implementation on
 // https://www.redblobgames.com/pathfinding/a-star/implementation.html
-// but adapted to array based grids and the 4 directional nature of grid neighbors
+// but adapted to array based grids. Searches either the 4 or 8 directional
+// grid neighbors, or does any-angle search with Theta* / Lazy Theta*
+// (http://idm-lab.org/bib/abstracts/papers/aaai10b.pdf) where a path node may
+// link to any node it has line of sight to. The grid modes can also search
+// from both ends at once, and every mode can use the landmark (ALT) bound in
+// place of the grid distance.
 
 using namespace std;
 
-i32 Index(Vector2 xy, i32 width)
-{
-  return xy.y * width + xy.x;
-}
-
-i32 UpNeighbor(i32 index, i32 width){
-  return  index - width;
+double Heuristic(i32 x, i32 y, i32 goalX, i32 goalY, u32 mode){
+  double dx = abs(x - goalX);
+  double dy = abs(y - goalY);
+  switch(mode){
+    case SEARCH_8DIR:
+      // octile distance
+      return (dx + dy) + (1.41421356237 - 2.0) * min(dx, dy);
+    case SEARCH_THETA:
+    case SEARCH_LAZY_THETA:
+      return sqrt(dx * dx + dy * dy);
+    default:
+      return dx + dy;
+  }
 }
 
-i32 DownNeighbor(i32 index, i32 width){
-  return index + width;
+// estimate of the cost left to the goal, the landmark bound is much tighter
+// than a grid distance since Weight() only charges height differences
+double NodeHeuristic(i32 index, i32 x, i32 y, i32 goalI, i32 goalX, i32 goalY, GameState *gs){
+  if(gs->use_landmarks && gs->num_landmarks > 0){
+    return LandmarkHeuristic(index, goalI, gs);
+  }
+  return Heuristic(x, y, goalX, goalY, gs->search_mode);
 }
 
-i32 LeftNeighbor(i32 index){
-  return index - 1;
-}
+// Per cell search state kept between queries, like GridSearch's. A cell's
+// entries only count when its stamp matches the current search, so nothing
+// is cleared or allocated per query.
+struct SearchWorkspace
+{
+  vector<i32> from;
+  vector<f64> pathCost;
+  vector<u32> seen;    // pathCost and from are valid when equal to stamp
+  vector<u32> closed;  // expanded with its current pathCost when equal to stamp
+  u32 stamp;
 
-i32 RightNeighbor(i32 index){
-  return index + 1;
-}
+  SearchWorkspace() : stamp(0) {}
 
-bool IsForestedOrWater(i32 index, GameState *gs){
-  if(gs->heightmap[index] < 200){
-   return true;
-  }
-  if(gs->forestmap[index] == 1){
-    return true;
+  // Begins a search over `cells` cells, the arrays only grow
+  void Start(i32 cells)
+  {
+    if(seen.size() < (size_t)cells)
+    {
+      from.resize(cells);
+      pathCost.resize(cells);
+      seen.assign(cells, 0);
+      closed.assign(cells, 0);
+      stamp = 0;
+    }
+    stamp += 1;
+    if(stamp == 0)
+    {
+      fill(seen.begin(), seen.end(), 0);
+      fill(closed.begin(), closed.end(), 0);
+      stamp = 1;
+    }
   }
-  return false;
-}
 
-double Weight(i32 curI, i32 nextI, GameState *gs){
-  // using the difference height map
-  return abs(gs->heightmap[nextI] - gs->heightmap[curI]);
-}
+  f64 Cost(i32 index) const { return (seen[index] == stamp) ? pathCost[index] : INFINITY; }
+  bool Closed(i32 index) const { return closed[index] == stamp; }
+  void Close(i32 index) { closed[index] = stamp; }
 
-Vector2 Vector(i32 index, GameState *gs){
-  Vector2 tmp = Vector2();
-  tmp.x = index % gs->map_width;
-  tmp.y = index / gs->map_width;
-  return tmp;
-}
+  // Reaches a cell, opening it again if it was closed
+  void Reach(i32 index, f64 cost, i32 parent)
+  {
+    seen[index] = stamp;
+    pathCost[index] = cost;
+    from[index] = parent;
+    closed[index] = 0;
+  }
+};
 
-double Heuristic(i32 index, Vector2 goal, GameState *gs){
-  Vector2 cur = Vector(index, gs);
-  return (abs(cur.x - goal.x) + abs(cur.y - goal.y));
+// The calling thread's workspaces, one per side of a bidirectional search.
+// UnidirectionalAStar() uses the first.
+SearchWorkspace *AStarWorkspaces()
+{
+  static thread_local SearchWorkspace workspaces[2];
+  return workspaces;
 }
 
-void AStar(GameState *gs)
+void UnidirectionalAStar(GameState *gs)
 {
+  i32 width = gs->map_width;
+  i32 cells = gs->map_width * gs->map_height;
+  u32 mode = gs->search_mode;
+  i32 numNeighbors = (mode == SEARCH_4DIR) ? 4 : 8;
+  bool anyAngle = (mode == SEARCH_THETA || mode == SEARCH_LAZY_THETA);
+
   PriorityQueue<int, double> frontier; //= PriorityQueue<int, double>();  // Priority Queue to traverse grid
-  unordered_map<int, int> from = unordered_map<int, int>();        // A map containing each node's previous path node
-  unordered_map<int, double> pathCost = unordered_map<int, double>(); // a map containing the lowest cost to get to any discovered grid node
+  SearchWorkspace &ws = AStarWorkspaces()[0]; // each node's previous path node and lowest cost so far
+  ws.Start(cells);
+  vector<i32> &from = ws.from;
+  vector<f64> &pathCost = ws.pathCost;
+  delete gs->path;
   gs->path = new list<int>();
   bool goalFound = false;
 
   int startI = Index(gs->player_pos, gs->map_width); // index of character's startng positin
   int goalI = Index(gs->target_pos, gs->map_width);
+  i32 goalX = gs->target_pos.x;
+  i32 goalY = gs->target_pos.y;
+  gs->search_expansions = 0;
+  gs->path_cost = INFINITY;
+
+  // index offsets of the neighbors, computed once rather than per push
+  i32 offsets[8];
+  for(i32 k = 0; k < 8; k++){
+    offsets[k] = NEIGHBOR_DY[k] * width + NEIGHBOR_DX[k];
+  }
 
   // initialize starting position values
   frontier.put(startI, 0.0);
-  from[startI] = startI;
-  pathCost[startI] = 0.0;
+  ws.Reach(startI, 0.0, startI);
 
-  printf("Start: %d, %d, %d\n", startI, startI % gs->map_width, startI / gs->map_width);
-  printf("Target: %d, %d, %d\n", goalI, goalI % gs->map_width, goalI / gs->map_width);
+  if(gs->search_log){
+    printf("Start: %d, %d, %d\n", startI, startI % gs->map_width, startI / gs->map_width);
+    printf("Target: %d, %d, %d\n", goalI, goalI % gs->map_width, goalI / gs->map_width);
+  }
+
+  // the landmarks know when the goal is on another island (or in the sea)
+  if(NodeHeuristic(startI, gs->player_pos.x, gs->player_pos.y, goalI, goalX, goalY, gs) == INFINITY){
+    return;
+  }
 
   while(!frontier.empty()) // while we have more nodes to check / traverse
   {
+    double key = frontier.top_priority();
     int curI = frontier.get();
 
-    //printf("Current: %d\n", curI);
+    // a node is pushed again every time its cost improves, skip the stale copies
+    if(ws.Closed(curI)){
+      continue;
+    }
+    ws.Close(curI);
+    gs->search_expansions += 1;
+    i32 curX = curI % width;
+    i32 curY = curI / width;
+
+    // Lazy Theta* assumed line of sight to the parent when it queued this
+    // node, and only a lower bound on its cost. Check it now and keep it only
+    // if no expanded neighbor is cheaper: Weight() charges every rise and fall,
+    // so a straight line over a hill can cost more than going round it.
+    if(mode == SEARCH_LAZY_THETA && from[curI] != curI)
+    {
+      i32 parentI = from[curI];
+      double lineCost;
+      pathCost[curI] = INFINITY;
+      if(LineOfSight(parentI, curI, gs, &lineCost))
+      {
+        pathCost[curI] = pathCost[parentI] + lineCost;
+      }
+      for(i32 k = 0; k < 8; k++)
+      {
+        i32 nextI = curI + offsets[k];
+        if(!CanStep(curX, curY, NEIGHBOR_DX[k], NEIGHBOR_DY[k], gs) || !ws.Closed(nextI)){
+          continue;
+        }
+        double newCost = pathCost[nextI] + Weight(nextI, curI, gs);
+        if(newCost < pathCost[curI]){
+          pathCost[curI] = newCost;
+          from[curI] = nextI;
+        }
+      }
+      // dearer than it was queued at, cheaper nodes may still lead here
+      double priority = pathCost[curI] + NodeHeuristic(curI, curX, curY, goalI, goalX, goalY, gs);
+      if(priority > key)
+      {
+        ws.Reach(curI, pathCost[curI], from[curI]);
+        frontier.put(curI, priority);
+        continue;
+      }
+    }
 
     if(curI == goalI) { // success case
       goalFound = true;
-      printf("GOAL FOUND!\n");
+      if(gs->search_log){
+        printf("GOAL FOUND!\n");
+      }
       break;
     }
-    //printf("Visiting: %d\n", current);
-    i32 leftI = LeftNeighbor(curI);
-    i32 RightI = RightNeighbor(curI);
-    i32 UpI = UpNeighbor(curI,  gs->map_width);
-    i32 DownI = DownNeighbor(curI,  gs->map_width);
-
-    //printf("lefti: %d, righti: %d, upi: %d, downi: %d\n", leftI, RightI, UpI, DownI);
 
     // if height map area > 200 then it's land
     // if we divide height map by 10 then it's > 20
     // forested: 0 = nonforested 1 = forested
-
-    if(!IsForestedOrWater(leftI, gs))
+    for(i32 k = 0; k < numNeighbors; k++)
     {
-      // calculate cost by adding up the path with the new Weight
-      double newCost = pathCost[curI] + Weight(curI, leftI, gs);
-
-      // if the index hasn't been discovered or if we found a shorter path
-      if(pathCost.find(leftI) == pathCost.end() || newCost < pathCost[leftI])
-      {
-
-          // initialize everything to represent the new calculated numbers
-          pathCost[leftI] = newCost;
-          double priority = newCost + Heuristic(leftI, gs->target_pos, gs);
-          frontier.put(leftI, priority);
-          from[leftI] = curI;
+      if(!CanStep(curX, curY, NEIGHBOR_DX[k], NEIGHBOR_DY[k], gs)){
+        continue;
       }
-    }
+      i32 nextI = curI + offsets[k];
+      i32 parentI = curI;
 
-    if(!IsForestedOrWater(RightI, gs))
-    {
-      // calculate cost by adding up the path with the new Weight
-      double newCost = pathCost[curI] + Weight(curI, RightI, gs);
+      // any-angle costs are only settled on expansion (lazily so for Lazy
+      // Theta*), reopening a node could then loop its parent chain
+      if(anyAngle && ws.Closed(nextI)){
+        continue;
+      }
 
-      // if the index hasn't been discovered or if we found a shorter path
-      if(pathCost.find(RightI) == pathCost.end() || newCost < pathCost[RightI])
+      // calculate cost by adding up the path with the new Weight, any-angle
+      // modes also try to link straight to the current node's parent
+      double newCost;
+      if(mode == SEARCH_THETA && from[curI] != curI)
       {
-
-          // initialize everything to represent the new calculated numbers
-          pathCost[RightI] = newCost;
-          double priority = newCost + Heuristic(RightI, gs->target_pos, gs);
-          frontier.put(RightI, priority);
-          from[RightI] = curI;
+        // the line is only taken when it is the cheaper way, see above
+        double lineCost;
+        newCost = pathCost[curI] + Weight(curI, nextI, gs);
+        if(LineOfSight(from[curI], nextI, gs, &lineCost) && pathCost[from[curI]] + lineCost <= newCost){
+          parentI = from[curI];
+          newCost = pathCost[parentI] + lineCost;
+        }
       }
-    }
-
-    if(!IsForestedOrWater(UpI, gs))
-    {
-      // calculate cost by adding up the path with the new Weight
-      double newCost = pathCost[curI] + Weight(curI, UpI, gs);
-
-      // if the index hasn't been discovered or if we found a shorter path
-      if(pathCost.find(UpI) == pathCost.end() || newCost < pathCost[UpI])
+      else if(mode == SEARCH_LAZY_THETA && from[curI] != curI)
       {
-          // initialize everything to represent the new calculated numbers
-          pathCost[UpI] = newCost;
-          double priority = newCost + Heuristic(UpI, gs->target_pos, gs);
-          frontier.put(UpI, priority);
-          from[UpI] = curI;
+        // the end point height difference never exceeds the line cost, so
+        // the step from here is taken when even that bound is dearer
+        newCost = pathCost[curI] + Weight(curI, nextI, gs);
+        if(pathCost[from[curI]] + Weight(from[curI], nextI, gs) < newCost){
+          parentI = from[curI];
+          newCost = pathCost[parentI] + Weight(parentI, nextI, gs);
+        }
+      }
+      else
+      {
+        newCost = pathCost[curI] + Weight(curI, nextI, gs);
       }
-    }
-
-    if(!IsForestedOrWater(DownI, gs))
-    {
-      // calculate cost by adding up the path with the new Weight
-      double newCost = pathCost[curI] + Weight(curI, DownI, gs);
 
       // if the index hasn't been discovered or if we found a shorter path
-      if(pathCost.find(DownI) == pathCost.end() || newCost < pathCost[DownI])
+      if(newCost < ws.Cost(nextI))
       {
-          // initialize everything to represent the new calculated numbers
-          pathCost[DownI] = newCost;
-          double priority = newCost + Heuristic(DownI, gs->target_pos, gs);
-          frontier.put(DownI, priority);
-          from[DownI] = curI;
+        // initialize everything to represent the new calculated numbers
+        ws.Reach(nextI, newCost, parentI);
+        double priority = newCost + NodeHeuristic(nextI, curX + NEIGHBOR_DX[k], curY + NEIGHBOR_DY[k], goalI, goalX, goalY, gs);
+        frontier.put(nextI, priority);
       }
     }
   }
@@ -176,12 +266,253 @@ void AStar(GameState *gs)
   }
 
   // finally put together the final path to return it
-  i32 tmp = Index(gs->target_pos, gs->map_width);
+  i32 tmp = goalI;
   gs->path->push_front(tmp);
-  while(from.find(tmp)->first != Index(gs->player_pos, gs->map_width))
+  while(tmp != startI)
   {
     tmp = from[tmp];
     gs->path->push_front(tmp);
   }
+  gs->path_cost = pathCost[goalI];
+  if(gs->search_log){
+    printf("Path nodes: %d, cost: %f, expanded: %d\n", (i32)gs->path->size(), gs->path_cost, gs->search_expansions);
+  }
   return;
 }
+
+// Searches forward from the agent and backward from the target at the same
+// time, always expanding the side with the lower queue key. Weight() and
+// CanStep() are symmetric so the backward search walks the same edges. Both
+// sides use the average potential (h to goal - h to start) / 2, negated for
+// the backward side, so they run Dijkstra on the same reduced costs and can
+// stop once the two lowest keys add up to the best path through a node
+// reached by both sides (Goldberg & Harrelson, see landmarks.h).
+void BidirectionalAStar(GameState *gs)
+{
+  i32 width = gs->map_width;
+  i32 cells = gs->map_width * gs->map_height;
+  i32 numNeighbors = (gs->search_mode == SEARCH_4DIR) ? 4 : 8;
+
+  // index 0 searches forward from the start, 1 backward from the goal
+  PriorityQueue<int, double> frontier[2];
+  SearchWorkspace *ws = AStarWorkspaces();
+  ws[0].Start(cells);
+  ws[1].Start(cells);
+  delete gs->path;
+  gs->path = new list<int>();
+
+  i32 ends[2] = {Index(gs->player_pos, width), Index(gs->target_pos, width)};
+  i32 endX[2] = {(i32)gs->player_pos.x, (i32)gs->target_pos.x};
+  i32 endY[2] = {(i32)gs->player_pos.y, (i32)gs->target_pos.y};
+  gs->search_expansions = 0;
+  gs->path_cost = INFINITY;
+
+  i32 offsets[8];
+  for(i32 k = 0; k < 8; k++){
+    offsets[k] = NEIGHBOR_DY[k] * width + NEIGHBOR_DX[k];
+  }
+
+  if(gs->search_log){
+    printf("Start: %d, %d, %d\n", ends[0], endX[0], endY[0]);
+    printf("Target: %d, %d, %d\n", ends[1], endX[1], endY[1]);
+  }
+
+  if(NodeHeuristic(ends[0], endX[0], endY[0], ends[1], endX[1], endY[1], gs) == INFINITY){
+    return;
+  }
+
+  for(i32 side = 0; side < 2; side++)
+  {
+    frontier[side].put(ends[side], 0.0);
+    ws[side].Reach(ends[side], 0.0, ends[side]);
+  }
+
+  double best = (ends[0] == ends[1]) ? 0.0 : INFINITY; // cheapest path found so far
+  i32 meetI = ends[0];
+
+  while(!frontier[0].empty() && !frontier[1].empty())
+  {
+    double key0 = frontier[0].top_priority();
+    double key1 = frontier[1].top_priority();
+    if(key0 + key1 >= best){
+      break;
+    }
+    i32 side = (key0 <= key1) ? 0 : 1;
+    i32 other = 1 - side;
+
+    int curI = frontier[side].get();
+    if(ws[side].Closed(curI)){
+      continue;
+    }
+    ws[side].Close(curI);
+    gs->search_expansions += 1;
+    i32 curX = curI % width;
+    i32 curY = curI / width;
+
+    for(i32 k = 0; k < numNeighbors; k++)
+    {
+      if(!CanStep(curX, curY, NEIGHBOR_DX[k], NEIGHBOR_DY[k], gs)){
+        continue;
+      }
+      i32 nextI = curI + offsets[k];
+      double newCost = ws[side].pathCost[curI] + Weight(curI, nextI, gs);
+      if(newCost < ws[side].Cost(nextI))
+      {
+        ws[side].Reach(nextI, newCost, curI);
+        i32 nextX = curX + NEIGHBOR_DX[k];
+        i32 nextY = curY + NEIGHBOR_DY[k];
+        double potential = 0.5 * (NodeHeuristic(nextI, nextX, nextY, ends[other], endX[other], endY[other], gs)
+          - NodeHeuristic(nextI, nextX, nextY, ends[side], endX[side], endY[side], gs));
+        frontier[side].put(nextI, newCost + potential);
+
+        if(newCost + ws[other].Cost(nextI) < best)
+        {
+          best = newCost + ws[other].Cost(nextI);
+          meetI = nextI;
+        }
+      }
+    }
+  }
+
+  if(best == INFINITY){
+    return;
+  }
+
+  // stitch the two halves together at the meeting node
+  i32 tmp = meetI;
+  gs->path->push_front(tmp);
+  while(tmp != ends[0])
+  {
+    tmp = ws[0].from[tmp];
+    gs->path->push_front(tmp);
+  }
+  tmp = meetI;
+  while(tmp != ends[1])
+  {
+    tmp = ws[1].from[tmp];
+    gs->path->push_back(tmp);
+  }
+  gs->path_cost = best;
+  if(gs->search_log){
+    printf("Path nodes: %d, cost: %f, expanded: %d\n", (i32)gs->path->size(), gs->path_cost, gs->search_expansions);
+  }
+}
+
+// True when AStar() runs exactly the search the state asks for. The cost
+// models other than height only have the grid kernel (GridAStar), searching
+// 4 or 8-dir from one end without the landmark bound, which only holds for
+// the height cost. Bidirectional search is only for the grid modes.
+bool SearchSupported(GameState *gs)
+{
+  bool grid = (gs->search_mode == SEARCH_4DIR || gs->search_mode == SEARCH_8DIR);
+  if(gs->cost_model != COST_HEIGHT && (!grid || gs->use_landmarks || gs->bidirectional)){
+    return false;
+  }
+  return !(gs->bidirectional && !grid);
+}
+
+// Changes the settings to the search AStar() really runs for them, for the
+// window where the keys toggle each setting on its own
+void UseSupportedSearch(GameState *gs)
+{
+  bool grid = (gs->search_mode == SEARCH_4DIR || gs->search_mode == SEARCH_8DIR);
+  if(gs->cost_model != COST_HEIGHT)
+  {
+    if(!grid){
+      gs->search_mode = SEARCH_8DIR;
+    }
+    grid = true;
+    gs->use_landmarks = false;
+    gs->bidirectional = false;
+  }
+  if(!grid){
+    gs->bidirectional = false;
+  }
+}
+
+// Answers a path query from the agent to the target into gs->path, trying
+// the path cache before running the selected search
+void AStar(GameState *gs)
+{
+  if(gs->use_path_cache && LookupPath(gs->path_cache, gs))
+  {
+    if(gs->search_log){
+      printf("Cached path nodes: %d, cost: %f\n", (i32)gs->path->size(), gs->path_cost);
+    }
+    return;
+  }
+
+  // a blocked goal can't be stepped into, and the landmarks can't tell it is
+  // unreachable when the start is blocked too, which leaves the search
+  // expanding the island under an infinite heuristic
+  if(IsForestedOrWater(Index(gs->target_pos, gs->map_width), gs))
+  {
+    delete gs->path;
+    gs->path = new list<int>();
+    gs->search_expansions = 0;
+    gs->path_cost = INFINITY;
+    return;
+  }
+
+  bool grid = (gs->search_mode == SEARCH_4DIR || gs->search_mode == SEARCH_8DIR);
+  if(gs->cost_model != COST_HEIGHT || (grid && !gs->bidirectional)){
+    GridAStar(gs);
+  }
+  else if(gs->search_mode == SEARCH_FLOWFIELD){
+    FlowFieldPath(gs);
+  }
+  else if(gs->bidirectional && grid){
+    BidirectionalAStar(gs);
+  }
+  else{
+    UnidirectionalAStar(gs);
+  }
+
+  if(gs->use_path_cache){
+    StorePath(gs->path_cache, gs);
+  }
+}
+
+// Points a state at the world's layers, landmarks and path cache, keeping
+// its own query fields. Call again after the world changes.
+void ShareWorld(GameState *view, GameState *gs)
+{
+  view->seed = gs->seed;
+  view->map_width = gs->map_width;
+  view->map_height = gs->map_height;
+  view->heightmap = gs->heightmap;
+  view->slopemap = gs->slopemap;
+  view->watermap = gs->watermap;
+  view->forestmap = gs->forestmap;
+  view->temperaturemap = gs->temperaturemap;
+  view->biomemap = gs->biomemap;
+  view->flowdir = gs->flowdir;
+  view->flowmap = gs->flowmap;
+  view->rivermap = gs->rivermap;
+  view->pyramid_levels = gs->pyramid_levels;
+  memcpy(view->pyramid, gs->pyramid, sizeof(gs->pyramid));
+  view->num_landmarks = gs->num_landmarks;
+  memcpy(view->landmarks, gs->landmarks, sizeof(gs->landmarks));
+  view->landmark_dist = gs->landmark_dist;
+  view->use_path_cache = gs->use_path_cache;
+  view->path_cache = gs->path_cache;
+  view->map_version = gs->map_version;
+}
+
+// A state for running AStar() on another thread, sharing the world with
+// `gs`. Flow fields aren't shared, their cache isn't thread safe, so the
+// view can't use SEARCH_FLOWFIELD.
+GameState *CreateWorldView(GameState *gs)
+{
+  GameState *view = new GameState();
+  ShareWorld(view, gs);
+  view->path = new list<int>();
+  view->search_log = false;
+  return view;
+}
+
+void DestroyWorldView(GameState *view)
+{
+  delete view->path;
+  delete view;
+}
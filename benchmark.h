@@ -0,0 +1,589 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#include "proc-gen.h"
+#include "astar.h"
+#include "pyramid.h"
+#include "hydrology.h"
+#include "biome.h"
+#include "path-smooth.h"
+
+// Headless benchmarks, run with `./proc-gen --bench [queries]`
+
+using namespace std;
+
+// p in [0, 1], sorts the samples in place
+f64 Percentile(vector<f64> &samples, f64 p)
+{
+  if(samples.empty()){
+    return 0.0;
+  }
+  sort(samples.begin(), samples.end());
+  size_t i = (size_t)(p * (samples.size() - 1) + 0.5);
+  return samples[i];
+}
+
+f64 MillisecondsSince(chrono::steady_clock::time_point start)
+{
+  return chrono::duration<f64, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// Cells of the largest stretch of land the agents can walk across, so
+// random start/goal pairs are connected rather than on different islands,
+// where the landmarks reject them without a search. A diagonal step can't
+// cut a corner (see CanStep), so 4-dir connected is 8-dir reachable.
+vector<i32> LargestLandRegion(GameState *gs)
+{
+  i32 width = gs->map_width;
+  i32 height = gs->map_height;
+  vector<u8> seen(width * height, 0);
+  vector<i32> best;
+  vector<i32> region;
+  vector<i32> stack;
+  for(i32 i = 0; i < width * height; i++)
+  {
+    if(seen[i] || IsForestedOrWater(i, gs)){
+      continue;
+    }
+    region.clear();
+    stack.push_back(i);
+    seen[i] = 1;
+    while(!stack.empty())
+    {
+      i32 cell = stack.back();
+      stack.pop_back();
+      region.push_back(cell);
+      i32 x = cell % width;
+      i32 y = cell / width;
+      for(i32 k = 0; k < 4; k++)
+      {
+        i32 nx = x + NEIGHBOR_DX[k];
+        i32 ny = y + NEIGHBOR_DY[k];
+        if(IsBlocked(nx, ny, gs)){
+          continue;
+        }
+        i32 next = ny * width + nx;
+        if(!seen[next])
+        {
+          seen[next] = 1;
+          stack.push_back(next);
+    } } }
+    if(region.size() > best.size()){
+      best.swap(region);
+  } }
+  sort(best.begin(), best.end());
+  return best;
+}
+
+struct SearchVariant
+{
+  const char *name;
+  u32 mode;
+  bool landmarks;
+  bool bidirectional;
+};
+
+// Runs the same random queries through every search variant and reports the
+// node expansions, latency and path cost of each
+void RunPathBenchmark(GameState *gs, u32 queries)
+{
+  chrono::steady_clock::time_point t = chrono::steady_clock::now();
+  BuildLandmarks(gs);
+  printf("Map %ux%u, seed %u, %u landmarks built in %.2f ms\n",
+    gs->map_width, gs->map_height, gs->seed, gs->num_landmarks, MillisecondsSince(t));
+
+  // random start/goal pairs on one stretch of land, shared by all variants
+  vector<i32> land = LargestLandRegion(gs);
+  if(land.empty() || queries == 0)
+  {
+    printf("Nothing to benchmark\n");
+    return;
+  }
+  srand(gs->seed);
+  vector<i32> starts(queries), goals(queries);
+  for(u32 q = 0; q < queries; q++)
+  {
+    starts[q] = land[rand() % land.size()];
+    goals[q] = land[rand() % land.size()];
+  }
+
+  SearchVariant variants[] = {
+    {"4-dir",                 SEARCH_4DIR,       false, false},
+    {"4-dir ALT",             SEARCH_4DIR,       true,  false},
+    {"4-dir bidir",           SEARCH_4DIR,       false, true},
+    {"4-dir bidir ALT",       SEARCH_4DIR,       true,  true},
+    {"8-dir",                 SEARCH_8DIR,       false, false},
+    {"8-dir ALT",             SEARCH_8DIR,       true,  false},
+    {"8-dir bidir",           SEARCH_8DIR,       false, true},
+    {"8-dir bidir ALT",       SEARCH_8DIR,       true,  true},
+    {"Theta*",                SEARCH_THETA,      false, false},
+    {"Theta* ALT",            SEARCH_THETA,      true,  false},
+    {"Lazy Theta*",           SEARCH_LAZY_THETA, false, false},
+    {"Lazy Theta* ALT",       SEARCH_LAZY_THETA, true,  false},
+  };
+
+  Vector2 player_pos = gs->player_pos;
+  Vector2 target_pos = gs->target_pos;
+  printf("%-18s %8s %12s %10s %10s %10s %12s\n",
+    "variant", "found", "expanded", "mean ms", "p50 ms", "p99 ms", "mean cost");
+  for(u32 v = 0; v < sizeof(variants) / sizeof(variants[0]); v++)
+  {
+    gs->search_mode = variants[v].mode;
+    gs->use_landmarks = variants[v].landmarks;
+    gs->bidirectional = variants[v].bidirectional;
+    gs->use_path_cache = false;
+
+    vector<f64> latency;
+    u64 expansions = 0;
+    u32 found = 0;
+    f64 cost = 0.0;
+    for(u32 q = 0; q < queries; q++)
+    {
+      gs->player_pos = /*(Vector2)*/{(f32)(starts[q] % gs->map_width), (f32)(starts[q] / gs->map_width)};
+      gs->target_pos = /*(Vector2)*/{(f32)(goals[q] % gs->map_width), (f32)(goals[q] / gs->map_width)};
+      t = chrono::steady_clock::now();
+      AStar(gs);
+      latency.push_back(MillisecondsSince(t));
+      expansions += gs->search_expansions;
+      if(!gs->path->empty())
+      {
+        found += 1;
+        cost += gs->path_cost;
+      }
+    }
+
+    f64 total = 0.0;
+    for(u32 q = 0; q < latency.size(); q++){
+      total += latency[q];
+    }
+    printf("%-18s %8u %12.1f %10.3f %10.3f %10.3f %12.1f\n",
+      variants[v].name, found, expansions / (f64)queries, total / queries,
+      Percentile(latency, 0.5), Percentile(latency, 0.99),
+      found ? cost / found : 0.0);
+  }
+
+  gs->player_pos = player_pos;
+  gs->target_pos = target_pos;
+}
+
+// Many agents heading for one cell: one A* per agent against one shared flow
+// field, then the cost of repairing the field after a small edit
+void RunFlowFieldBenchmark(GameState *gs, u32 agents)
+{
+  vector<i32> land = LargestLandRegion(gs);
+  if(land.empty() || agents == 0){
+    return;
+  }
+  srand(gs->seed + 1);
+  i32 target = land[rand() % land.size()];
+  vector<i32> starts(agents);
+  for(u32 a = 0; a < agents; a++){
+    starts[a] = land[rand() % land.size()];
+  }
+
+  Vector2 player_pos = gs->player_pos;
+  Vector2 target_pos = gs->target_pos;
+  gs->target_pos = /*(Vector2)*/{(f32)(target % gs->map_width), (f32)(target / gs->map_width)};
+  gs->search_mode = SEARCH_8DIR;
+  gs->use_landmarks = true;
+  gs->bidirectional = false;
+  gs->use_path_cache = false;
+
+  chrono::steady_clock::time_point t = chrono::steady_clock::now();
+  u32 found = 0;
+  for(u32 a = 0; a < agents; a++)
+  {
+    gs->player_pos = /*(Vector2)*/{(f32)(starts[a] % gs->map_width), (f32)(starts[a] / gs->map_width)};
+    AStar(gs);
+    found += !gs->path->empty();
+  }
+  f64 astarMs = MillisecondsSince(t);
+
+  ClearFlowFieldCache(gs->flowfields);
+  t = chrono::steady_clock::now();
+  FlowField *field = GetFlowField(gs->flowfields, target, gs);
+  f64 buildMs = MillisecondsSince(t);
+  t = chrono::steady_clock::now();
+  u32 steps = 0;
+  u32 reached = 0;
+  for(u32 a = 0; a < agents; a++)
+  {
+    i32 cur = starts[a];
+    if(field->dir[cur] == FLOW_NONE){
+      continue;
+    }
+    for(i32 next = FlowNext(field, cur, gs->map_width); next != -1; next = FlowNext(field, next, gs->map_width)){
+      steps += 1;
+    }
+    reached += 1;
+  }
+  f64 followMs = MillisecondsSince(t);
+
+  printf("\n%u agents to one target: 8-dir ALT A* %.2f ms (%u found), "
+    "flow field build %.2f ms + follow %.2f ms (%u reached, %u steps)\n",
+    agents, astarMs, found, buildMs, followMs, reached, steps);
+
+  // a forest brush halfway along the first agent's route
+  i32 mid = starts[0];
+  for(u32 s = 0; s < steps / agents / 2 && FlowNext(field, mid, gs->map_width) != -1; s++){
+    mid = FlowNext(field, mid, gs->map_width);
+  }
+  DirtyRect rect;
+  rect.x0 = max((i32)(mid % gs->map_width) - 2, 0);
+  rect.y0 = max((i32)(mid / gs->map_width) - 2, 0);
+  rect.x1 = min((i32)(mid % gs->map_width) + 2, (i32)gs->map_width - 1);
+  rect.y1 = min((i32)(mid / gs->map_width) + 2, (i32)gs->map_height - 1);
+  vector<u8> saved(gs->forestmap, gs->forestmap + gs->map_width * gs->map_height);
+  for(i32 y = rect.y0; y <= rect.y1; y++){
+    for(i32 x = rect.x0; x <= rect.x1; x++){
+      gs->forestmap[y * gs->map_width + x] = 1;
+  } }
+  MarkFlowFieldsDirty(gs->flowfields, rect);
+  t = chrono::steady_clock::now();
+  field = GetFlowField(gs->flowfields, target, gs);
+  f64 repairMs = MillisecondsSince(t);
+
+  FlowField rebuilt;
+  rebuilt.target = target;
+  t = chrono::steady_clock::now();
+  BuildFlowField(&rebuilt, gs);
+  f64 rebuildMs = MillisecondsSince(t);
+  bool same = rebuilt.cost == field->cost;
+  printf("5x5 forest edit: repair %.2f ms, full rebuild %.2f ms, %s\n",
+    repairMs, rebuildMs, same ? "costs match" : "COSTS DIFFER");
+
+  copy(saved.begin(), saved.end(), gs->forestmap);
+  ClearFlowFieldCache(gs->flowfields);
+  gs->player_pos = player_pos;
+  gs->target_pos = target_pos;
+}
+
+// Checks the compiled grid kernel against the generic search loop on the
+// same queries: identical paths, and how much time the inlining saves
+void RunGridKernelBenchmark(GameState *gs, u32 queries)
+{
+  vector<i32> land = LargestLandRegion(gs);
+  if(land.empty() || queries == 0){
+    return;
+  }
+  srand(gs->seed + 3);
+  vector<i32> starts(queries), goals(queries);
+  for(u32 q = 0; q < queries; q++)
+  {
+    starts[q] = land[rand() % land.size()];
+    goals[q] = land[rand() % land.size()];
+  }
+
+  Vector2 player_pos = gs->player_pos;
+  Vector2 target_pos = gs->target_pos;
+  gs->bidirectional = false;
+  gs->use_path_cache = false;
+  printf("\n%-18s %12s %12s %10s\n", "kernel check", "generic ms", "kernel ms", "same paths");
+  for(u32 v = 0; v < 4; v++)
+  {
+    gs->search_mode = (v < 2) ? SEARCH_4DIR : SEARCH_8DIR;
+    gs->use_landmarks = (v % 2 == 1);
+    f64 genericMs = 0.0;
+    f64 kernelMs = 0.0;
+    u32 same = 0;
+    for(u32 q = 0; q < queries; q++)
+    {
+      gs->player_pos = /*(Vector2)*/{(f32)(starts[q] % gs->map_width), (f32)(starts[q] / gs->map_width)};
+      gs->target_pos = /*(Vector2)*/{(f32)(goals[q] % gs->map_width), (f32)(goals[q] / gs->map_width)};
+      chrono::steady_clock::time_point t = chrono::steady_clock::now();
+      UnidirectionalAStar(gs);
+      genericMs += MillisecondsSince(t);
+      list<int> generic = *gs->path;
+      f64 genericCost = gs->path_cost;
+
+      t = chrono::steady_clock::now();
+      GridAStar(gs);
+      kernelMs += MillisecondsSince(t);
+      same += (generic == *gs->path && (genericCost == gs->path_cost || generic.empty()));
+    }
+    printf("%-18s %12.2f %12.2f %7u/%u\n",
+      v == 0 ? "4-dir" : v == 1 ? "4-dir ALT" : v == 2 ? "8-dir" : "8-dir ALT",
+      genericMs, kernelMs, same, queries);
+  }
+
+  // the other cost models only exist in the kernel
+  const char *costnames[] = {"slope cost", "moisture cost", "biome cost"};
+  for(u32 c = 0; c < 3; c++)
+  {
+    gs->search_mode = SEARCH_8DIR;
+    gs->cost_model = COST_SLOPE + c;
+    chrono::steady_clock::time_point t = chrono::steady_clock::now();
+    u64 expansions = 0;
+    for(u32 q = 0; q < queries; q++)
+    {
+      gs->player_pos = /*(Vector2)*/{(f32)(starts[q] % gs->map_width), (f32)(starts[q] / gs->map_width)};
+      gs->target_pos = /*(Vector2)*/{(f32)(goals[q] % gs->map_width), (f32)(goals[q] / gs->map_width)};
+      GridAStar(gs);
+      expansions += gs->search_expansions;
+    }
+    printf("8-dir %-12s %12s %12.2f  (%.1f expanded per query)\n",
+      costnames[c], "-", MillisecondsSince(t), expansions / (f64)queries);
+  }
+  gs->cost_model = COST_HEIGHT;
+
+  gs->player_pos = player_pos;
+  gs->target_pos = target_pos;
+}
+
+// A click stream with repeats: half the queries repeat an earlier one, a
+// quarter start somewhere along an earlier path to the same goal
+void RunPathCacheBenchmark(GameState *gs, u32 queries)
+{
+  vector<i32> land = LargestLandRegion(gs);
+  if(land.empty() || queries == 0){
+    return;
+  }
+
+  Vector2 player_pos = gs->player_pos;
+  Vector2 target_pos = gs->target_pos;
+  gs->search_mode = SEARCH_8DIR;
+  gs->bidirectional = false;
+
+  // the same click stream under every cost model, a cached answer has to
+  // come back with the path and cost the search gave
+  printf("\n%u queries with repeats:\n", queries);
+  const char *costnames[] = {"height cost", "slope cost", "moisture cost", "biome cost"};
+  for(u32 c = 0; c < 4; c++)
+  {
+    gs->cost_model = c;
+    gs->use_landmarks = (c == COST_HEIGHT); // only a bound on the height cost
+
+    // uncached run, also gives the paths the sub-path queries start on
+    srand(gs->seed + 2);
+    vector<i32> starts, goals;
+    vector<vector<i32> > paths;
+    vector<f64> costs;
+    gs->use_path_cache = false;
+    chrono::steady_clock::time_point t = chrono::steady_clock::now();
+    for(u32 q = 0; q < queries; q++)
+    {
+      i32 kind = rand() % 4;
+      i32 start, goal;
+      if(kind < 2 && !starts.empty())
+      {
+        u32 earlier = rand() % starts.size();
+        start = starts[earlier];
+        goal = goals[earlier];
+      }
+      else if(kind == 2 && !paths.empty() && !paths[paths.size() - 1].empty())
+      {
+        vector<i32> &earlier = paths[paths.size() - 1];
+        start = earlier[rand() % earlier.size()];
+        goal = earlier[earlier.size() - 1];
+      }
+      else
+      {
+        start = land[rand() % land.size()];
+        goal = land[rand() % land.size()];
+      }
+      starts.push_back(start);
+      goals.push_back(goal);
+      gs->player_pos = /*(Vector2)*/{(f32)(start % gs->map_width), (f32)(start / gs->map_width)};
+      gs->target_pos = /*(Vector2)*/{(f32)(goal % gs->map_width), (f32)(goal / gs->map_width)};
+      AStar(gs);
+      paths.push_back(vector<i32>(gs->path->begin(), gs->path->end()));
+      costs.push_back(gs->path_cost);
+    }
+    f64 uncachedMs = MillisecondsSince(t);
+
+    gs->use_path_cache = true;
+    gs->path_cache->hits = 0;
+    gs->path_cache->subpath_hits = 0;
+    gs->path_cache->misses = 0;
+    u32 lengths = 0;
+    u32 costed = 0;
+    t = chrono::steady_clock::now();
+    for(u32 q = 0; q < queries; q++)
+    {
+      gs->player_pos = /*(Vector2)*/{(f32)(starts[q] % gs->map_width), (f32)(starts[q] / gs->map_width)};
+      gs->target_pos = /*(Vector2)*/{(f32)(goals[q] % gs->map_width), (f32)(goals[q] / gs->map_width)};
+      AStar(gs);
+      lengths += (gs->path->size() != paths[q].size());
+      // sub-paths sum their steps in another order, allow for the rounding
+      bool same = (gs->path_cost == costs[q]) || fabs(gs->path_cost - costs[q]) <= 1e-9 * fabs(costs[q]);
+      costed += !same;
+    }
+    f64 cachedMs = MillisecondsSince(t);
+
+    printf("  %-14s uncached %.2f ms, cached %.2f ms (%llu hits, %llu sub-path hits, %llu misses, "
+      "%u path lengths and %u costs differ)\n",
+      costnames[c], uncachedMs, cachedMs,
+      (unsigned long long)gs->path_cache->hits,
+      (unsigned long long)gs->path_cache->subpath_hits,
+      (unsigned long long)gs->path_cache->misses, lengths, costed);
+  }
+  gs->cost_model = COST_HEIGHT;
+
+  gs->player_pos = player_pos;
+  gs->target_pos = target_pos;
+}
+
+// Time to rebuild the pyramid the zoomed out view draws from
+void RunPyramidBenchmark(GameState *gs)
+{
+  chrono::steady_clock::time_point t = chrono::steady_clock::now();
+  BuildPyramid(gs);
+  printf("\n%u pyramid levels built in %.2f ms\n", gs->pyramid_levels, MillisecondsSince(t));
+}
+
+// Waypoints per path against cells, the smoothing time, and a check that
+// every segment is walkable and the waypoints cost no more than the path
+template<typename Cost>
+bool CheckWaypoints(const Cost &cost, GameState *gs, f64 *smoothedCost)
+{
+  *smoothedCost = 0.0;
+  for(u32 w = 1; w < gs->waypoints.size(); w++)
+  {
+    f64 segment;
+    if(!LineCost(cost, gs->waypoints[w - 1], gs->waypoints[w], gs->map_width, &segment)){
+      return false;
+    }
+    *smoothedCost += segment;
+  }
+  return gs->waypoints.front() == gs->path->front() && gs->waypoints.back() == gs->path->back();
+}
+
+void RunPathSmoothingBenchmark(GameState *gs, u32 queries)
+{
+  vector<i32> land = LargestLandRegion(gs);
+  if(land.empty() || queries == 0){
+    return;
+  }
+  srand(gs->seed + 5);
+  vector<i32> starts(queries), goals(queries);
+  for(u32 q = 0; q < queries; q++)
+  {
+    starts[q] = land[rand() % land.size()];
+    goals[q] = land[rand() % land.size()];
+  }
+
+  SearchVariant variants[] = {
+    {"4-dir ALT",  SEARCH_4DIR,  true, false},
+    {"8-dir ALT",  SEARCH_8DIR,  true, false},
+    {"Theta* ALT", SEARCH_THETA, true, false},
+  };
+  Vector2 player_pos = gs->player_pos;
+  Vector2 target_pos = gs->target_pos;
+  gs->cost_model = COST_HEIGHT;
+  gs->bidirectional = false;
+  gs->use_path_cache = false;
+  // a list node is two links and the int padded to a third, before the
+  // allocator's own overhead
+  size_t nodeBytes = 3 * sizeof(void *);
+  printf("\n%-18s %10s %10s %12s %12s %10s %10s\n",
+    "path smoothing", "cells", "waypoints", "list bytes", "vector bytes", "smooth ms", "cost ratio");
+  for(u32 v = 0; v < sizeof(variants) / sizeof(variants[0]); v++)
+  {
+    gs->search_mode = variants[v].mode;
+    gs->use_landmarks = variants[v].landmarks;
+    u64 cells = 0;
+    u64 waypoints = 0;
+    f64 ms = 0.0;
+    f64 ratio = 0.0;
+    u32 found = 0;
+    u32 bad = 0;
+    for(u32 q = 0; q < queries; q++)
+    {
+      gs->player_pos = /*(Vector2)*/{(f32)(starts[q] % gs->map_width), (f32)(starts[q] / gs->map_width)};
+      gs->target_pos = /*(Vector2)*/{(f32)(goals[q] % gs->map_width), (f32)(goals[q] / gs->map_width)};
+      AStar(gs);
+      if(gs->path->empty()){
+        continue;
+      }
+      chrono::steady_clock::time_point t = chrono::steady_clock::now();
+      SmoothPath(gs);
+      ms += MillisecondsSince(t);
+
+      HeightCost cost = {gs};
+      f64 smoothed;
+      if(!CheckWaypoints(cost, gs, &smoothed) || smoothed > gs->path_cost + 1e-6 * (1.0 + gs->path_cost)){
+        bad += 1;
+      }
+      cells += gs->path->size();
+      waypoints += gs->waypoints.size();
+      ratio += gs->path_cost > 0.0 ? smoothed / gs->path_cost : 1.0;
+      found += 1;
+    }
+    if(found == 0){
+      continue;
+    }
+    printf("%-18s %10.1f %10.1f %12.0f %12.0f %10.3f %10.3f%s\n", variants[v].name,
+      cells / (f64)found, waypoints / (f64)found, cells * nodeBytes / (f64)found,
+      waypoints * sizeof(i32) / (f64)found, ms / found, ratio / found,
+      bad ? " BAD WAYPOINTS" : "");
+  }
+
+  gs->player_pos = player_pos;
+  gs->target_pos = target_pos;
+}
+
+// Times the erosion and river stage alone on the current world's terrain,
+// leaving the world as it was
+void RunHydrologyBenchmark(GameState *gs)
+{
+  u32 cells = gs->map_width * gs->map_height;
+  vector<f32> heightmap(gs->heightmap, gs->heightmap + cells);
+  vector<u8> watermap(gs->watermap, gs->watermap + cells);
+  vector<u8> rivermap(gs->rivermap, gs->rivermap + cells);
+
+  chrono::steady_clock::time_point t = chrono::steady_clock::now();
+  SimulateHydrology(gs);
+  f64 ms = MillisecondsSince(t);
+
+  u32 rivers = 0;
+  f64 eroded = 0.0;
+  for(u32 i = 0; i < cells; i++)
+  {
+    rivers += (gs->rivermap[i] != 0);
+    eroded += heightmap[i] - gs->heightmap[i];
+  }
+  printf("\nHydrology on %ux%u with %u threads: %.2f ms, %u river cells, mean height change %.3f\n",
+    gs->map_width, gs->map_height, max(thread::hardware_concurrency(), 1u), ms, rivers, eroded / cells);
+
+  copy(heightmap.begin(), heightmap.end(), gs->heightmap);
+  copy(watermap.begin(), watermap.end(), gs->watermap);
+  copy(rivermap.begin(), rivermap.end(), gs->rivermap);
+}
+
+// Times the biome pass over the whole map and prints how much of the land
+// each biome covers
+void RunBiomeBenchmark(GameState *gs)
+{
+  u32 cells = gs->map_width * gs->map_height;
+  const u32 runs = 10;
+  chrono::steady_clock::time_point t = chrono::steady_clock::now();
+  for(u32 r = 0; r < runs; r++)
+  {
+    ClassifyBiomes(gs, 0, cells);
+  }
+  f64 ms = MillisecondsSince(t) / runs;
+
+  u32 counts[BIOME_COUNT] = {0};
+  for(u32 i = 0; i < cells; i++)
+  {
+    counts[gs->biomemap[i]] += 1;
+  }
+  u32 land = cells - counts[BIOME_OCEAN];
+  printf("\nBiomes on %ux%u: %.2f ms (%.2f ns per cell)\n", gs->map_width, gs->map_height,
+    ms, ms * 1e6 / cells);
+  for(u32 b = 0; b < BIOME_COUNT; b++)
+  {
+    if(b == BIOME_OCEAN){
+      continue;
+    }
+    printf("  %-12s %5.1f%% of land\n", BIOME_NAMES[b], land ? 100.0 * counts[b] / land : 0.0);
+  }
+}
+
+#endif
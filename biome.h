@@ -0,0 +1,250 @@
+#ifndef BIOME_H
+#define BIOME_H
+
+#include <math.h>
+#include <algorithm>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "proc-gen.h"
+#include "hydrology.h"
+
+// Biomes classify each cell once from its elevation, slope, moisture,
+// temperature, rivers and forest. The renderer colours them through
+// BIOME_COLORS and the biome cost model prices steps with BIOME_COST, so
+// neither redoes the thresholds.
+
+#define BIOME_OCEAN      0
+#define BIOME_RIVER      1
+#define BIOME_MARSH      2
+#define BIOME_DESERT     3
+#define BIOME_GRASSLAND  4
+#define BIOME_SHRUBLAND  5
+#define BIOME_TUNDRA     6
+#define BIOME_HILLS      7
+#define BIOME_ROCK       8
+#define BIOME_SNOW       9
+#define BIOME_TAIGA      10
+#define BIOME_FOREST     11
+#define BIOME_RAINFOREST 12
+#define BIOME_COUNT      13
+
+// rivers this strong or more are wide enough to be a biome of their own
+#define BIOME_RIVER_MIN 96
+
+// temperature bands, 0-255
+#define TEMPERATURE_COLD 85
+#define TEMPERATURE_HOT  170
+
+// moisture bands, the wet one is where forest grows
+#define MOISTURE_DRY 20
+#define MOISTURE_WET 55
+
+const char *BIOME_NAMES[BIOME_COUNT] = {
+  "ocean", "river", "marsh", "desert", "grassland", "shrubland", "tundra",
+  "hills", "rock", "snow", "taiga", "forest", "rainforest"
+};
+
+const Color BIOME_COLORS[BIOME_COUNT] = {
+  BLUE,                 // ocean
+  SKYBLUE,              // river
+  {76, 128, 96, 255},   // marsh
+  {236, 204, 124, 255}, // desert
+  GREEN,                // grassland
+  LIME,                 // shrubland
+  {160, 172, 150, 255}, // tundra
+  BEIGE,                // hills
+  LIGHTGRAY,            // rock
+  RAYWHITE,             // snow
+  {28, 92, 64, 255},    // taiga
+  DARKGREEN,            // forest
+  {0, 92, 24, 255}      // rainforest
+};
+
+// Multiplies the distance walked over a cell. Forest and ocean block the
+// searches, so their entries are never charged.
+const f32 BIOME_COST[BIOME_COUNT] = {
+  8.0f,  // ocean
+  4.0f,  // river, fording
+  3.0f,  // marsh
+  1.5f,  // desert
+  1.0f,  // grassland
+  1.25f, // shrubland
+  1.5f,  // tundra
+  2.0f,  // hills
+  3.0f,  // rock
+  4.0f,  // snow
+  8.0f,  // taiga
+  8.0f,  // forest
+  8.0f   // rainforest
+};
+
+// Terrain classes, the first index of BIOME_TABLE. Open land is split into
+// 5 slope bands starting at TERRAIN_FLAT.
+#define TERRAIN_SEA    0
+#define TERRAIN_RIVER  1
+#define TERRAIN_FOREST 2
+#define TERRAIN_FLAT   3
+#define TERRAIN_COUNT  8
+
+// [terrain][cold, temperate, hot][dry, moist, wet]
+const u8 BIOME_TABLE[TERRAIN_COUNT][3][3] = {
+  { // sea
+    {BIOME_OCEAN, BIOME_OCEAN, BIOME_OCEAN},
+    {BIOME_OCEAN, BIOME_OCEAN, BIOME_OCEAN},
+    {BIOME_OCEAN, BIOME_OCEAN, BIOME_OCEAN} },
+  { // river
+    {BIOME_RIVER, BIOME_RIVER, BIOME_RIVER},
+    {BIOME_RIVER, BIOME_RIVER, BIOME_RIVER},
+    {BIOME_RIVER, BIOME_RIVER, BIOME_RIVER} },
+  { // forest
+    {BIOME_TAIGA, BIOME_TAIGA, BIOME_TAIGA},
+    {BIOME_FOREST, BIOME_FOREST, BIOME_FOREST},
+    {BIOME_RAINFOREST, BIOME_RAINFOREST, BIOME_RAINFOREST} },
+  { // flat, slope up to 20
+    {BIOME_TUNDRA, BIOME_TUNDRA, BIOME_TUNDRA},
+    {BIOME_GRASSLAND, BIOME_GRASSLAND, BIOME_MARSH},
+    {BIOME_DESERT, BIOME_GRASSLAND, BIOME_MARSH} },
+  { // gentle, up to 45
+    {BIOME_TUNDRA, BIOME_TUNDRA, BIOME_TUNDRA},
+    {BIOME_SHRUBLAND, BIOME_SHRUBLAND, BIOME_SHRUBLAND},
+    {BIOME_DESERT, BIOME_SHRUBLAND, BIOME_SHRUBLAND} },
+  { // hills, up to 63
+    {BIOME_TUNDRA, BIOME_TUNDRA, BIOME_TUNDRA},
+    {BIOME_HILLS, BIOME_HILLS, BIOME_HILLS},
+    {BIOME_HILLS, BIOME_HILLS, BIOME_HILLS} },
+  { // rock, up to 75
+    {BIOME_SNOW, BIOME_SNOW, BIOME_SNOW},
+    {BIOME_ROCK, BIOME_ROCK, BIOME_ROCK},
+    {BIOME_ROCK, BIOME_ROCK, BIOME_ROCK} },
+  { // peaks
+    {BIOME_SNOW, BIOME_SNOW, BIOME_SNOW},
+    {BIOME_SNOW, BIOME_SNOW, BIOME_SNOW},
+    {BIOME_SNOW, BIOME_SNOW, BIOME_SNOW} }
+};
+
+// Key into BIOME_TABLE of one cell. Each factor is reduced to a band with
+// compares rather than branches.
+u8 BiomeKey(f32 height, u32 slope, u8 temperature, u8 water, u8 river, u8 forest)
+{
+  u32 land = height >= SEA_LEVEL;
+  u32 isRiver = river >= BIOME_RIVER_MIN;
+  u32 isForest = (forest == 1) & !isRiver;
+  u32 open = !isRiver & !isForest;
+  u32 steep = (slope > 20) + (slope > 45) + (slope > 63) + (slope > 75);
+  u32 terrain = land * (isRiver * TERRAIN_RIVER + isForest * TERRAIN_FOREST
+    + open * (TERRAIN_FLAT + steep));
+  u32 band = (temperature >= TEMPERATURE_COLD) + (temperature > TEMPERATURE_HOT);
+  u32 moisture = (water > MOISTURE_DRY) + (water > MOISTURE_WET);
+  return terrain * 9 + band * 3 + moisture;
+}
+
+#if defined(__SSE2__)
+// 1 in each byte of v above threshold, 0 elsewhere
+__m128i BytesAbove(__m128i v, u8 threshold)
+{
+  return _mm_min_epu8(_mm_subs_epu8(v, _mm_set1_epi8((char)threshold)), _mm_set1_epi8(1));
+}
+
+// Narrows 16 values of 0-255 in four vectors of u32 to bytes
+__m128i PackBytes(__m128i a, __m128i b, __m128i c, __m128i d)
+{
+  return _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+}
+
+// Slopes clamped to 255, past every band, so they pack to bytes
+__m128i LoadSlopes(const u32 *slope)
+{
+  const __m128i bias = _mm_set1_epi32((int)0x80000000u);
+  const __m128i top = _mm_set1_epi32(255);
+  __m128i s = _mm_loadu_si128((const __m128i *)slope);
+  __m128i over = _mm_cmpgt_epi32(_mm_xor_si128(s, bias), _mm_xor_si128(top, bias));
+  return _mm_or_si128(_mm_andnot_si128(over, s), _mm_and_si128(over, top));
+}
+
+__m128i LoadLand(const f32 *height)
+{
+  return _mm_and_si128(_mm_castps_si128(_mm_cmpge_ps(_mm_loadu_ps(height), _mm_set1_ps(SEA_LEVEL))),
+    _mm_set1_epi32(1));
+}
+#endif
+
+// Classifies `count` cells from their layers in one pass. With SSE2 the
+// BiomeKey() bands are worked out for 16 cells at a time, then looked up one
+// by one, SSE2 has no byte shuffle to do the table in registers.
+void ClassifyBiomeCells(const f32 *height, const u32 *slope, const u8 *temperature,
+  const u8 *water, const u8 *river, const u8 *forest, u8 *biome, size_t count)
+{
+  const u8 *table = &BIOME_TABLE[0][0][0];
+  size_t i = 0;
+#if defined(__SSE2__)
+  const __m128i one = _mm_set1_epi8(1);
+  for (; i + 16 <= count; i += 16)
+  {
+    __m128i land = PackBytes(LoadLand(height + i), LoadLand(height + i + 4),
+      LoadLand(height + i + 8), LoadLand(height + i + 12));
+    __m128i s = PackBytes(LoadSlopes(slope + i), LoadSlopes(slope + i + 4),
+      LoadSlopes(slope + i + 8), LoadSlopes(slope + i + 12));
+    __m128i r = _mm_loadu_si128((const __m128i *)(river + i));
+    __m128i f = _mm_loadu_si128((const __m128i *)(forest + i));
+    __m128i t = _mm_loadu_si128((const __m128i *)(temperature + i));
+    __m128i w = _mm_loadu_si128((const __m128i *)(water + i));
+
+    __m128i isRiver = BytesAbove(r, BIOME_RIVER_MIN - 1);
+    __m128i isForest = _mm_andnot_si128(isRiver, _mm_and_si128(_mm_cmpeq_epi8(f, one), one));
+    __m128i open = _mm_xor_si128(_mm_or_si128(isRiver, isForest), one);
+    __m128i steep = _mm_add_epi8(_mm_add_epi8(BytesAbove(s, 20), BytesAbove(s, 45)),
+      _mm_add_epi8(BytesAbove(s, 63), BytesAbove(s, 75)));
+    // the 0 or 1 flags become masks by negating them
+    __m128i zero = _mm_setzero_si128();
+    __m128i terrain = _mm_add_epi8(_mm_add_epi8(isRiver, _mm_add_epi8(isForest, isForest)),
+      _mm_and_si128(_mm_sub_epi8(zero, open), _mm_add_epi8(steep, _mm_set1_epi8(TERRAIN_FLAT))));
+    terrain = _mm_and_si128(_mm_sub_epi8(zero, land), terrain);
+    __m128i band = _mm_add_epi8(BytesAbove(t, TEMPERATURE_COLD - 1), BytesAbove(t, TEMPERATURE_HOT));
+    __m128i moisture = _mm_add_epi8(BytesAbove(w, MOISTURE_DRY), BytesAbove(w, MOISTURE_WET));
+    // terrain * 9 + band * 3 + moisture, none of it carries out of a byte
+    __m128i key = _mm_add_epi8(_mm_add_epi8(_mm_slli_epi16(terrain, 3), terrain),
+      _mm_add_epi8(_mm_add_epi8(band, _mm_add_epi8(band, band)), moisture));
+
+    u8 keys[16];
+    _mm_storeu_si128((__m128i *)keys, key);
+    for (u32 k = 0; k < 16; k++)
+    {
+      biome[i + k] = table[keys[k]];
+  } }
+#endif
+  for (; i < count; i++)
+  {
+    biome[i] = table[BiomeKey(height[i], slope[i], temperature[i], water[i], river[i], forest[i])];
+} }
+
+// Classifies cells [begin, end) of the map
+void ClassifyBiomes(GameState *gs, u32 begin, u32 end)
+{
+  ClassifyBiomeCells(gs->heightmap + begin, gs->slopemap + begin, gs->temperaturemap + begin,
+    gs->watermap + begin, gs->rivermap + begin, gs->forestmap + begin, gs->biomemap + begin,
+    end - begin);
+}
+
+// Most common biome of up to 4 cells, the first one seen on a tie
+u8 DominantBiome(const u8 *biomes, u32 count)
+{
+  u8 best = biomes[0];
+  u32 bestCount = 0;
+  for (u32 a = 0; a < count; a++)
+  {
+    u32 n = 0;
+    for (u32 b = 0; b < count; b++)
+    {
+      n += (biomes[b] == biomes[a]);
+    }
+    if (n > bestCount)
+    {
+      best = biomes[a];
+      bestCount = n;
+  } }
+  return best;
+}
+
+#endif
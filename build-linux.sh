@@ -133,7 +133,8 @@ if [ ! -d "$TEMP_DIR" ]; then
 fi
 
 CC=g++
-COMPILATION_FLAGS="-std=c++11 -Os -flto"
+# no fused multiply-adds, so worlds match on every machine (--hash-layers)
+COMPILATION_FLAGS="-std=c++11 -Os -flto -ffp-contract=off"
 
 # Build the actual game
 mkdir -p $OUTPUT_DIR
@@ -0,0 +1,529 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+#include "proc-gen.h"
+#include "random.h"
+#include "biome.h"
+
+// Streams an island of any size straight to disk, `./proc-gen --export
+// prefix --size n`. The map is generated and written in bands of rows, so
+// memory is bounded by two bands whatever the size: one being generated on
+// every core while the other is written out on its own thread.
+//
+// Only the per cell stages run: height, water, slope, temperature, forest
+// and biomes. The hydrology and the pyramid need the whole map, so an
+// exported island is uneroded and has no rivers.
+//
+// Writes, next to `prefix`:
+//   -height.raw          16-bit little endian heights, row after row
+//   -height.png          the same as a 16-bit greyscale PNG
+//   -tile-X-Y.png/.pgw   tiles of the height PNG, each with a world file
+//                        placing it on the map (GeoTIFF style georeferencing
+//                        without needing libtiff)
+//   -preview.png         the map colours of a mapmode, one cell in
+//                        preview_scale each way
+
+using namespace std;
+
+// defined in proc-gen.cpp
+void NoiseOffset(u32 seed, u64 stream, i32 *xoffset, i32 *yoffset);
+f32 HeightAt(u32 x, u32 y, u32 width, u32 height, i32 xoffset, i32 yoffset);
+u32 SlopeAt(const f32 *h, u32 x, u32 y, u32 width, u32 height, i64 stride);
+u8 WaterAt(u32 x, u32 y, u32 width, u32 height, i32 xoffset, i32 yoffset);
+u8 TemperatureAt(u32 x, u32 y, u32 width, u32 height, i32 xoffset, i32 yoffset, f32 h);
+u8 ForestAt(f32 h, u8 water, u8 river);
+Color MapColor(u32 mapmode, f32 e, u32 s, u8 w, bool f, u8 r, u8 b);
+
+#define EXPORT_HEIGHT_SCALE (65535.0f / 2550.0f)
+#define EXPORT_FILE_BUFFER  (1 << 20)
+
+// Streaming PNG -----------------------------------------------------------------
+
+// The image data is a zlib stream of stored (uncompressed) deflate blocks, so
+// rows go out as they come without buffering anything to compress. Each
+// call to WritePngRows() is one IDAT chunk.
+typedef struct PngStream
+{
+  FILE *file;
+  u32 width;
+  u32 height;
+  u32 row_bytes; // without the filter byte
+  u32 rows_written;
+  u32 crc;       // of the chunk being written
+  u32 adler_a;   // of the uncompressed image data
+  u32 adler_b;
+} PngStream;
+
+u32 CRC_TABLE[256];
+
+void InitCrcTable()
+{
+  for (u32 n = 0; n < 256; n++)
+  {
+    u32 c = n;
+    for (u32 k = 0; k < 8; k++)
+    {
+      c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+    }
+    CRC_TABLE[n] = c;
+} }
+
+void PngPut(PngStream *png, const u8 *data, size_t size)
+{
+  u32 c = png->crc;
+  for (size_t i = 0; i < size; i++)
+  {
+    c = CRC_TABLE[(c ^ data[i]) & 0xFF] ^ (c >> 8);
+  }
+  png->crc = c;
+  fwrite(data, 1, size, png->file);
+}
+
+void PngPutU32(PngStream *png, u32 v)
+{
+  u8 bytes[4] = {(u8)(v >> 24), (u8)(v >> 16), (u8)(v >> 8), (u8)v};
+  PngPut(png, bytes, 4);
+}
+
+// Puts image data bytes, keeping their Adler-32
+void PngPutData(PngStream *png, const u8 *data, size_t size)
+{
+  u32 a = png->adler_a;
+  u32 b = png->adler_b;
+  for (size_t i = 0; i < size; i++)
+  {
+    a += data[i];
+    b += a;
+    // reducing every byte is slow, 5552 bytes is as far as b can go
+    if ((i & 4095) == 4095)
+    {
+      a %= 65521;
+      b %= 65521;
+  } }
+  png->adler_a = a % 65521;
+  png->adler_b = b % 65521;
+  PngPut(png, data, size);
+}
+
+void BeginPngChunk(PngStream *png, u32 length, const char *type)
+{
+  u8 bytes[4] = {(u8)(length >> 24), (u8)(length >> 16), (u8)(length >> 8), (u8)length};
+  fwrite(bytes, 1, 4, png->file);
+  png->crc = 0xFFFFFFFFu;
+  PngPut(png, (const u8 *)type, 4);
+}
+
+void EndPngChunk(PngStream *png)
+{
+  u32 crc = png->crc ^ 0xFFFFFFFFu;
+  u8 bytes[4] = {(u8)(crc >> 24), (u8)(crc >> 16), (u8)(crc >> 8), (u8)crc};
+  fwrite(bytes, 1, 4, png->file);
+}
+
+// depth 8 or 16, channels 1 (grey) or 3 (RGB)
+bool BeginPng(PngStream *png, const char *path, u32 width, u32 height, u32 depth, u32 channels)
+{
+  png->file = fopen(path, "wb");
+  if (!png->file) return false;
+  setvbuf(png->file, NULL, _IOFBF, EXPORT_FILE_BUFFER);
+  png->width = width;
+  png->height = height;
+  png->row_bytes = width * channels * (depth / 8);
+  png->rows_written = 0;
+  png->adler_a = 1;
+  png->adler_b = 0;
+
+  const u8 signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+  fwrite(signature, 1, 8, png->file);
+
+  BeginPngChunk(png, 13, "IHDR");
+  PngPutU32(png, width);
+  PngPutU32(png, height);
+  u8 header[5] = {(u8)depth, (u8)(channels == 3 ? 2 : 0), 0, 0, 0};
+  PngPut(png, header, 5);
+  EndPngChunk(png);
+
+  // zlib header, 32K window and no preset dictionary
+  BeginPngChunk(png, 2, "IDAT");
+  u8 zlib[2] = {0x78, 0x01};
+  PngPut(png, zlib, 2);
+  EndPngChunk(png);
+  return true;
+}
+
+// Appends `count` rows of samples, `stride` bytes apart. 16-bit samples are
+// big endian.
+void WritePngRows(PngStream *png, const u8 *rows, size_t stride, u32 count)
+{
+  const size_t max_block = 65535;
+  size_t data = (size_t)count * (png->row_bytes + 1);
+  size_t blocks = (data + max_block - 1) / max_block;
+  BeginPngChunk(png, (u32)(data + 5 * blocks), "IDAT");
+
+  // stored blocks cut across rows, the filter byte (0, none) included
+  size_t block_left = 0;
+  for (u32 r = 0; r < count; r++)
+  {
+    const u8 filter = 0;
+    const u8 *row = rows + r * stride;
+    size_t row_left = png->row_bytes + 1;
+    size_t pos = 0; // into filter byte + row
+    while (row_left > 0)
+    {
+      if (block_left == 0)
+      {
+        block_left = min(max_block, data);
+        u8 header[5] = {0, (u8)block_left, (u8)(block_left >> 8), (u8)~block_left, (u8)(~block_left >> 8)};
+        PngPut(png, header, 5);
+      }
+      size_t n = min(block_left, row_left);
+      if (pos == 0)
+      {
+        PngPutData(png, &filter, 1);
+        n -= 1;
+        pos = 1;
+        row_left -= 1;
+        block_left -= 1;
+        data -= 1;
+      }
+      PngPutData(png, row + pos - 1, n);
+      pos += n;
+      row_left -= n;
+      block_left -= n;
+      data -= n;
+  } }
+  EndPngChunk(png);
+  png->rows_written += count;
+}
+
+bool EndPng(PngStream *png)
+{
+  // an empty final block, then the Adler-32 of the data
+  BeginPngChunk(png, 9, "IDAT");
+  u8 last[5] = {1, 0, 0, 0xFF, 0xFF};
+  PngPut(png, last, 5);
+  PngPutU32(png, (png->adler_b << 16) | png->adler_a);
+  EndPngChunk(png);
+
+  BeginPngChunk(png, 0, "IEND");
+  EndPngChunk(png);
+  bool ok = !ferror(png->file) && png->rows_written == png->height;
+  return (fclose(png->file) == 0) && ok;
+}
+
+// Export ------------------------------------------------------------------------
+
+typedef struct ExportSettings
+{
+  const char *prefix;
+  u32 seed;
+  u32 size;
+  u32 band_rows;
+  u32 tile;          // tile width and height in cells
+  u32 preview_scale; // cells per preview pixel each way
+  u32 mapmode;       // of the preview
+} ExportSettings;
+
+// The layers of rows [y0, y0 + rows). Heights have a row either side for
+// the slope.
+typedef struct ExportBand
+{
+  u32 y0;
+  u32 rows;
+  vector<f32> height;
+  vector<u32> slope;
+  vector<u8> water;
+  vector<u8> temperature;
+  vector<u8> river; // always dry, see above
+  vector<u8> forest;
+  vector<u8> biome;
+} ExportBand;
+
+typedef struct ExportWriter
+{
+  const ExportSettings *settings;
+  FILE *raw;
+  PngStream height;
+  PngStream preview;
+  vector<PngStream> tiles; // the current row of tiles
+  u32 tile_row;
+  vector<u8> big_endian;   // a band of 16-bit samples each way
+  vector<u8> little_endian;
+  vector<u8> colours;
+  bool ok;
+  f64 write_ms;
+} ExportWriter;
+
+typedef struct ExportOffsets
+{
+  i32 height_x, height_y;
+  i32 water_x, water_y;
+  i32 temperature_x, temperature_y;
+} ExportOffsets;
+
+// Heights of band rows [r0, r1), counting the row above the band as 0
+void GenerateBandHeights(const ExportSettings *settings, const ExportOffsets *offsets,
+  ExportBand *band, u32 r0, u32 r1)
+{
+  u32 size = settings->size;
+  for (u32 r = r0; r < r1; r++)
+  {
+    i64 y = (i64)band->y0 + r - 1;
+    if (y < 0 || y >= size) continue;
+    f32 *row = &band->height[(size_t)r * size];
+    for (u32 x = 0; x < size; x++)
+    {
+      row[x] = HeightAt(x, (u32)y, size, size, offsets->height_x, offsets->height_y);
+} } }
+
+// Everything else for band rows [r0, r1), the heights being done
+void GenerateBandLayers(const ExportSettings *settings, const ExportOffsets *offsets,
+  ExportBand *band, u32 r0, u32 r1)
+{
+  u32 size = settings->size;
+  for (u32 r = r0; r < r1; r++)
+  {
+    u32 y = band->y0 + r;
+    size_t row = (size_t)r * size;
+    const f32 *h = &band->height[row + size];
+    for (u32 x = 0; x < size; x++)
+    {
+      band->slope[row + x] = SlopeAt(&h[x], x, y, size, size, size);
+      band->water[row + x] = WaterAt(x, y, size, size, offsets->water_x, offsets->water_y);
+      band->temperature[row + x] = TemperatureAt(x, y, size, size,
+        offsets->temperature_x, offsets->temperature_y, h[x]);
+      band->forest[row + x] = ForestAt(h[x], band->water[row + x], 0);
+    }
+    ClassifyBiomeCells(h, &band->slope[row], &band->temperature[row], &band->water[row],
+      &band->river[row], &band->forest[row], &band->biome[row], size);
+} }
+
+// Runs a band step over its rows on every core
+void RunBandRows(void (*step)(const ExportSettings *, const ExportOffsets *, ExportBand *, u32, u32),
+  const ExportSettings *settings, const ExportOffsets *offsets, ExportBand *band, u32 rows)
+{
+  u32 threads = min(max(thread::hardware_concurrency(), 1u), rows);
+  vector<thread> workers;
+  for (u32 t = 1; t < threads; t++)
+  {
+    workers.push_back(thread(step, settings, offsets, band, rows * t / threads, rows * (t + 1) / threads));
+  }
+  step(settings, offsets, band, 0, rows / threads);
+  for (u32 t = 0; t < workers.size(); t++)
+  {
+    workers[t].join();
+} }
+
+void GenerateBand(const ExportSettings *settings, const ExportOffsets *offsets, ExportBand *band)
+{
+  RunBandRows(GenerateBandHeights, settings, offsets, band, band->rows + 2);
+  RunBandRows(GenerateBandLayers, settings, offsets, band, band->rows);
+}
+
+// name of one of the output files
+void ExportPath(char *path, size_t size, const ExportSettings *settings, const char *suffix)
+{
+  snprintf(path, size, "%s-%s", settings->prefix, suffix);
+}
+
+// Opens the tiles of tile row `ty` and writes their world files
+bool BeginTileRow(ExportWriter *out, u32 ty)
+{
+  const ExportSettings *settings = out->settings;
+  u32 tiles_x = (settings->size + settings->tile - 1) / settings->tile;
+  u32 height = min(settings->tile, settings->size - ty * settings->tile);
+  out->tiles.resize(tiles_x);
+  out->tile_row = ty;
+  for (u32 tx = 0; tx < tiles_x; tx++)
+  {
+    u32 width = min(settings->tile, settings->size - tx * settings->tile);
+    char name[64];
+    char path[1024];
+    snprintf(name, sizeof(name), "tile-%u-%u.png", tx, ty);
+    ExportPath(path, sizeof(path), settings, name);
+    if (!BeginPng(&out->tiles[tx], path, width, height, 16, 1)) return false;
+
+    // world file: cell size, rotation, rotation, -cell size, then the
+    // center of the top left cell, map rows running down
+    snprintf(name, sizeof(name), "tile-%u-%u.pgw", tx, ty);
+    ExportPath(path, sizeof(path), settings, name);
+    FILE *world = fopen(path, "w");
+    if (!world) return false;
+    fprintf(world, "1.0\n0.0\n0.0\n-1.0\n%.1f\n%.1f\n",
+      tx * settings->tile + 0.5, -(ty * (f64)settings->tile + 0.5));
+    if (fclose(world) != 0) return false;
+  }
+  return true;
+}
+
+bool EndTileRow(ExportWriter *out)
+{
+  bool ok = true;
+  for (u32 t = 0; t < out->tiles.size(); t++)
+  {
+    ok = EndPng(&out->tiles[t]) && ok;
+  }
+  out->tiles.clear();
+  return ok;
+}
+
+// Writes a generated band to every output, on the writer thread
+void WriteBand(ExportWriter *out, const ExportBand *band)
+{
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  const ExportSettings *settings = out->settings;
+  u32 size = settings->size;
+  size_t cells = (size_t)band->rows * size;
+
+  for (size_t i = 0; i < cells; i++)
+  {
+    u16 v = (u16)(band->height[size + i] * EXPORT_HEIGHT_SCALE + 0.5f);
+    out->big_endian[2 * i] = (u8)(v >> 8);
+    out->big_endian[2 * i + 1] = (u8)v;
+    out->little_endian[2 * i] = (u8)v;
+    out->little_endian[2 * i + 1] = (u8)(v >> 8);
+  }
+  fwrite(&out->little_endian[0], 2, cells, out->raw);
+  WritePngRows(&out->height, &out->big_endian[0], 2 * size, band->rows);
+
+  // a band can end one row of tiles and start the next
+  u32 r = 0;
+  while (r < band->rows && out->ok)
+  {
+    u32 y = band->y0 + r;
+    u32 ty = y / settings->tile;
+    if (ty != out->tile_row || out->tiles.empty())
+    {
+      out->ok = (out->tiles.empty() || EndTileRow(out)) && BeginTileRow(out, ty);
+      if (!out->ok) break;
+    }
+    u32 rows = min(band->rows - r, (ty + 1) * settings->tile - y);
+    for (u32 tx = 0; tx < out->tiles.size(); tx++)
+    {
+      WritePngRows(&out->tiles[tx], &out->big_endian[2 * ((size_t)r * size + tx * settings->tile)],
+        2 * size, rows);
+    }
+    r += rows;
+  }
+
+  u32 scale = settings->preview_scale;
+  u32 preview_width = out->preview.width;
+  for (u32 r = 0; r < band->rows; r++)
+  {
+    if ((band->y0 + r) % scale != 0) continue;
+    for (u32 px = 0; px < preview_width; px++)
+    {
+      size_t i = (size_t)r * size + (size_t)px * scale;
+      Color c = MapColor(settings->mapmode, band->height[size + i] / 10.0f, band->slope[i],
+        band->water[i], band->forest[i] == 1, band->river[i], band->biome[i]);
+      out->colours[3 * px] = c.r;
+      out->colours[3 * px + 1] = c.g;
+      out->colours[3 * px + 2] = c.b;
+    }
+    WritePngRows(&out->preview, &out->colours[0], 3 * preview_width, 1);
+  }
+
+  out->ok = out->ok && !ferror(out->raw);
+  out->write_ms += chrono::duration<f64, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// Generates and writes the island, returns false when a file couldn't be
+// written
+bool ExportWorld(const ExportSettings *settings)
+{
+  u32 size = settings->size;
+  u32 band_rows = min(max(settings->band_rows, 1u), size);
+  InitCrcTable();
+
+  ExportOffsets offsets;
+  NoiseOffset(settings->seed, STREAM_HEIGHT, &offsets.height_x, &offsets.height_y);
+  NoiseOffset(settings->seed, STREAM_WATER, &offsets.water_x, &offsets.water_y);
+  NoiseOffset(settings->seed, STREAM_TEMPERATURE, &offsets.temperature_x, &offsets.temperature_y);
+
+  ExportWriter out;
+  out.settings = settings;
+  out.tile_row = 0;
+  out.ok = true;
+  out.write_ms = 0.0;
+  out.big_endian.resize((size_t)band_rows * size * 2);
+  out.little_endian.resize((size_t)band_rows * size * 2);
+  u32 preview_size = (size + settings->preview_scale - 1) / settings->preview_scale;
+  out.colours.resize((size_t)preview_size * 3);
+
+  char path[1024];
+  ExportPath(path, sizeof(path), settings, "height.raw");
+  out.raw = fopen(path, "wb");
+  if (!out.raw)
+  {
+    printf("Can't write %s\n", path);
+    return false;
+  }
+  setvbuf(out.raw, NULL, _IOFBF, EXPORT_FILE_BUFFER);
+  ExportPath(path, sizeof(path), settings, "height.png");
+  bool opened = BeginPng(&out.height, path, size, size, 16, 1);
+  ExportPath(path, sizeof(path), settings, "preview.png");
+  opened = opened && BeginPng(&out.preview, path, preview_size, preview_size, 8, 3);
+  if (!opened)
+  {
+    printf("Can't write %s\n", path);
+    fclose(out.raw);
+    return false;
+  }
+
+  ExportBand bands[2];
+  for (u32 b = 0; b < 2; b++)
+  {
+    bands[b].height.resize((size_t)(band_rows + 2) * size);
+    bands[b].slope.resize((size_t)band_rows * size);
+    bands[b].water.resize((size_t)band_rows * size);
+    bands[b].temperature.resize((size_t)band_rows * size);
+    bands[b].river.assign((size_t)band_rows * size, 0);
+    bands[b].forest.resize((size_t)band_rows * size);
+    bands[b].biome.resize((size_t)band_rows * size);
+  }
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  f64 wait_ms = 0.0;
+  thread writer;
+  u32 count = 0;
+  for (u32 y0 = 0; y0 < size; y0 += band_rows, count++)
+  {
+    // generate into one band while the writer still has the other
+    ExportBand *band = &bands[count & 1];
+    band->y0 = y0;
+    band->rows = min(band_rows, size - y0);
+    GenerateBand(settings, &offsets, band);
+
+    chrono::steady_clock::time_point waited = chrono::steady_clock::now();
+    if (writer.joinable()) writer.join();
+    wait_ms += chrono::duration<f64, milli>(chrono::steady_clock::now() - waited).count();
+    if (!out.ok) break;
+    writer = thread(WriteBand, &out, band);
+  }
+  if (writer.joinable()) writer.join();
+
+  bool ok = out.ok;
+  ok = (out.tiles.empty() || EndTileRow(&out)) && ok;
+  ok = EndPng(&out.height) && ok;
+  ok = EndPng(&out.preview) && ok;
+  ok = (fclose(out.raw) == 0) && ok;
+
+  f64 ms = chrono::duration<f64, milli>(chrono::steady_clock::now() - start).count();
+  size_t band_bytes = bands[0].height.size() * sizeof(f32) + bands[0].slope.size() * sizeof(u32)
+    + 5 * bands[0].water.size() + 2 * out.big_endian.size();
+  printf("Exported %ux%u in %u bands of %u rows: %.2f s, writing %.2f s of it on its own thread, "
+    "%.2f s waiting for it, %.1f MB of band buffers\n",
+    size, size, count, band_rows, ms / 1000.0, out.write_ms / 1000.0, wait_ms / 1000.0,
+    2 * band_bytes / (1024.0 * 1024.0));
+  if (!ok) printf("Writing the export failed\n");
+  return ok;
+}
+
+#endif
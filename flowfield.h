@@ -0,0 +1,304 @@
+#ifndef FLOWFIELD_H
+#define FLOWFIELD_H
+
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <math.h>
+
+#include "proc-gen.h"
+#include "grid.h"
+
+// Flow fields for many agents heading to the same cell, see
+// https://www.redblobgames.com/pathfinding/tower-defense/
+// One reverse Dijkstra from the target stores, for every cell, which of its 8
+// neighbors is the next step towards the target. Following a field is then a
+// single table lookup per step, no matter how many agents share it.
+
+#define FLOW_TARGET 8
+#define FLOW_NONE   255
+
+// width of a cost bucket, see PropagateFlowField
+#define FLOW_BUCKET_WIDTH 16.0
+
+#define FLOWFIELD_CACHE_SIZE 8
+
+using namespace std;
+
+struct DirtyRect
+{
+  i32 x0, y0, x1, y1; // inclusive
+};
+
+struct FlowField
+{
+  i32 target;
+  vector<u8> dir;    // neighbor index of the next step, FLOW_TARGET or FLOW_NONE
+  vector<f32> cost;  // path cost to the target, kept to repair edits
+  vector<DirtyRect> dirty; // edits since the field was last brought up to date
+};
+
+// Least recently used fields first in `order`
+struct FlowFieldCache
+{
+  u32 capacity;
+  list<FlowField *> order;
+  unordered_map<i32, list<FlowField *>::iterator> fields;
+  u32 builds;
+  u32 repairs;
+  u32 hits;
+};
+
+FlowFieldCache *CreateFlowFieldCache(u32 capacity)
+{
+  FlowFieldCache *cache = new FlowFieldCache();
+  cache->capacity = capacity;
+  cache->builds = 0;
+  cache->repairs = 0;
+  cache->hits = 0;
+  return cache;
+}
+
+void ClearFlowFieldCache(FlowFieldCache *cache)
+{
+  for(list<FlowField *>::iterator it = cache->order.begin(); it != cache->order.end(); ++it){
+    delete *it;
+  }
+  cache->order.clear();
+  cache->fields.clear();
+}
+
+// Dijkstra with the queue replaced by buckets of FLOW_BUCKET_WIDTH cost. Cells
+// within a bucket are relaxed in any order and requeued if they improve later,
+// so the result is exact while each queue operation is a vector push.
+// Propagates outwards from `seeds`, whose costs must already be set.
+void PropagateFlowField(FlowField *field, vector<i32> &seeds, GameState *gs)
+{
+  i32 width = gs->map_width;
+  vector<vector<i32> > buckets;
+  for(u32 s = 0; s < seeds.size(); s++)
+  {
+    u32 b = (u32)(field->cost[seeds[s]] / FLOW_BUCKET_WIDTH);
+    if(b >= buckets.size()){
+      buckets.resize(b + 1);
+    }
+    buckets[b].push_back(seeds[s]);
+  }
+
+  vector<i32> current;
+  for(u32 b = 0; b < buckets.size(); b++)
+  {
+    while(!buckets[b].empty())
+    {
+      current.swap(buckets[b]);
+      buckets[b].clear();
+      for(u32 c = 0; c < current.size(); c++)
+      {
+        i32 curI = current[c];
+        f32 curCost = field->cost[curI];
+        // improved into a later cell of this bucket, or stale
+        if((u32)(curCost / FLOW_BUCKET_WIDTH) != b){
+          continue;
+        }
+        i32 curX = curI % width;
+        i32 curY = curI / width;
+        for(i32 k = 0; k < 8; k++)
+        {
+          if(!CanStep(curX, curY, NEIGHBOR_DX[k], NEIGHBOR_DY[k], gs)){
+            continue;
+          }
+          i32 nextI = curI + NEIGHBOR_DY[k] * width + NEIGHBOR_DX[k];
+          f32 newCost = curCost + Weight(curI, nextI, gs);
+          if(newCost < field->cost[nextI])
+          {
+            field->cost[nextI] = newCost;
+            field->dir[nextI] = NEIGHBOR_OPPOSITE[k];
+            u32 nb = (u32)(newCost / FLOW_BUCKET_WIDTH);
+            if(nb >= buckets.size()){
+              buckets.resize(nb + 1);
+            }
+            buckets[nb].push_back(nextI);
+      } } }
+      current.clear();
+} } }
+
+void BuildFlowField(FlowField *field, GameState *gs)
+{
+  u32 cells = gs->map_width * gs->map_height;
+  field->dir.assign(cells, FLOW_NONE);
+  field->cost.assign(cells, INFINITY);
+  field->dirty.clear();
+  if(IsForestedOrWater(field->target, gs)){
+    return;
+  }
+  field->dir[field->target] = FLOW_TARGET;
+  field->cost[field->target] = 0.0f;
+  vector<i32> seeds(1, field->target);
+  PropagateFlowField(field, seeds, gs);
+}
+
+// Brings a field up to date after terrain edits without redoing all of it.
+// Every cell whose route ran through an edited cell loses its cost, then the
+// Dijkstra restarts from the untouched cells bordering them. Edits that open
+// up cheaper routes are picked up by the same pass since relaxation carries on
+// past the invalidated cells.
+void RepairFlowField(FlowField *field, GameState *gs)
+{
+  i32 width = gs->map_width;
+  i32 height = gs->map_height;
+  vector<u8> invalid(width * height, 0);
+  vector<i32> stack;
+
+  for(u32 r = 0; r < field->dirty.size(); r++)
+  {
+    // an edited cell also changes the diagonal steps around its corners
+    DirtyRect rect = field->dirty[r];
+    for(i32 y = max(rect.y0 - 1, 0); y <= min(rect.y1 + 1, height - 1); y++)
+    {
+      for(i32 x = max(rect.x0 - 1, 0); x <= min(rect.x1 + 1, width - 1); x++)
+      {
+        i32 index = y * width + x;
+        if(index == field->target)
+        {
+          BuildFlowField(field, gs);
+          return;
+        }
+        if(!invalid[index])
+        {
+          invalid[index] = 1;
+          stack.push_back(index);
+  } } } }
+  field->dirty.clear();
+
+  // everything upstream of an edited cell routes through it
+  vector<i32> cleared;
+  while(!stack.empty())
+  {
+    i32 curI = stack.back();
+    stack.pop_back();
+    cleared.push_back(curI);
+    i32 curX = curI % width;
+    i32 curY = curI / width;
+    for(i32 k = 0; k < 8; k++)
+    {
+      i32 nextX = curX + NEIGHBOR_DX[k];
+      i32 nextY = curY + NEIGHBOR_DY[k];
+      if(nextX < 0 || nextY < 0 || nextX >= width || nextY >= height){
+        continue;
+      }
+      i32 nextI = nextY * width + nextX;
+      if(!invalid[nextI] && field->dir[nextI] == NEIGHBOR_OPPOSITE[k])
+      {
+        invalid[nextI] = 1;
+        stack.push_back(nextI);
+  } } }
+
+  for(u32 c = 0; c < cleared.size(); c++)
+  {
+    field->cost[cleared[c]] = INFINITY;
+    field->dir[cleared[c]] = FLOW_NONE;
+  }
+
+  // restart from the reachable cells around the hole
+  vector<i32> seeds;
+  for(u32 c = 0; c < cleared.size(); c++)
+  {
+    i32 curX = cleared[c] % width;
+    i32 curY = cleared[c] / width;
+    for(i32 k = 0; k < 8; k++)
+    {
+      i32 nextX = curX + NEIGHBOR_DX[k];
+      i32 nextY = curY + NEIGHBOR_DY[k];
+      if(nextX < 0 || nextY < 0 || nextX >= width || nextY >= height){
+        continue;
+      }
+      i32 nextI = nextY * width + nextX;
+      if(!invalid[nextI] && field->cost[nextI] != INFINITY)
+      {
+        // flag it so it's only seeded once
+        invalid[nextI] = 1;
+        seeds.push_back(nextI);
+  } } }
+  PropagateFlowField(field, seeds, gs);
+}
+
+// Returns the up to date field for a target cell, building it if needed and
+// evicting the least recently used field when the cache is full
+FlowField *GetFlowField(FlowFieldCache *cache, i32 target, GameState *gs)
+{
+  unordered_map<i32, list<FlowField *>::iterator>::iterator found = cache->fields.find(target);
+  if(found != cache->fields.end())
+  {
+    FlowField *field = *found->second;
+    cache->order.splice(cache->order.end(), cache->order, found->second);
+    if(!field->dirty.empty())
+    {
+      RepairFlowField(field, gs);
+      cache->repairs += 1;
+    }
+    else
+    {
+      cache->hits += 1;
+    }
+    return field;
+  }
+
+  FlowField *field;
+  if(cache->order.size() >= cache->capacity)
+  {
+    field = cache->order.front();
+    cache->fields.erase(field->target);
+    cache->order.pop_front();
+  }
+  else
+  {
+    field = new FlowField();
+  }
+  field->target = target;
+  BuildFlowField(field, gs);
+  cache->builds += 1;
+  cache->order.push_back(field);
+  cache->fields[target] = --cache->order.end();
+  return field;
+}
+
+// Records an edited area on every cached field, they repair on next use
+void MarkFlowFieldsDirty(FlowFieldCache *cache, DirtyRect rect)
+{
+  for(list<FlowField *>::iterator it = cache->order.begin(); it != cache->order.end(); ++it){
+    (*it)->dirty.push_back(rect);
+  }
+}
+
+// Next cell on the way to the field's target, -1 if the target can't be
+// reached (or `index` is the target)
+i32 FlowNext(FlowField *field, i32 index, i32 width)
+{
+  u8 d = field->dir[index];
+  if(d >= 8){
+    return -1;
+  }
+  return index + NEIGHBOR_DY[d] * width + NEIGHBOR_DX[d];
+}
+
+// Fills gs->path by following the field for the target from the agent
+void FlowFieldPath(GameState *gs)
+{
+  i32 width = gs->map_width;
+  i32 startI = Index(gs->player_pos, width);
+  i32 goalI = Index(gs->target_pos, width);
+  FlowField *field = GetFlowField(gs->flowfields, goalI, gs);
+
+  delete gs->path;
+  gs->path = new list<int>();
+  gs->search_expansions = 0;
+  gs->path_cost = field->cost[startI];
+  if(field->dir[startI] == FLOW_NONE){
+    return;
+  }
+  for(i32 tmp = startI; tmp != -1; tmp = FlowNext(field, tmp, width)){
+    gs->path->push_back(tmp);
+  }
+}
+
+#endif
@@ -0,0 +1,349 @@
+#ifndef GRID_SEARCH_H
+#define GRID_SEARCH_H
+
+#include <vector>
+#include <list>
+#include <math.h>
+
+#include "priority-queue.h"
+#include "proc-gen.h"
+#include "grid.h"
+#include "landmarks.h"
+#include "biome.h"
+
+// A* over the 4 or 8 grid neighbors with the step cost, heuristic,
+// connectivity and queue picked at compile time, so they all inline into the
+// search loop instead of being branched on per node. Explores in the same
+// order as UnidirectionalAStar() does for the grid modes; the benchmark checks
+// the two agree.
+//
+// Cost policies: bool Passable(i32 index), f64 Step(i32 from, i32 to, f64 length)
+// Heuristic policies: void SetGoal(i32 goal, i32 goalX, i32 goalY),
+//   f64 Estimate(i32 index, i32 x, i32 y)
+// Connectivity: count, dx[], dy[], length[] in neighbor order
+
+using namespace std;
+
+// Connectivity -----------------------------------------------------------------
+struct FourConnected
+{
+  static const i32 count = 4;
+  static constexpr i32 dx[4] = {-1, 1,  0, 0};
+  static constexpr i32 dy[4] = { 0, 0, -1, 1};
+  static constexpr f64 length[4] = {1.0, 1.0, 1.0, 1.0};
+};
+constexpr i32 FourConnected::dx[4];
+constexpr i32 FourConnected::dy[4];
+constexpr f64 FourConnected::length[4];
+
+struct EightConnected
+{
+  static const i32 count = 8;
+  static constexpr i32 dx[8] = {-1, 1,  0, 0, -1,  1, -1, 1};
+  static constexpr i32 dy[8] = { 0, 0, -1, 1, -1, -1,  1, 1};
+  static constexpr f64 length[8] = {1.0, 1.0, 1.0, 1.0,
+    1.41421356237, 1.41421356237, 1.41421356237, 1.41421356237};
+};
+constexpr i32 EightConnected::dx[8];
+constexpr i32 EightConnected::dy[8];
+constexpr f64 EightConnected::length[8];
+
+// Step costs -------------------------------------------------------------------
+
+// Weight(): the height difference, distance is free
+struct HeightCost
+{
+  GameState *gs;
+  bool Passable(i32 index) const { return !IsForestedOrWater(index, gs); }
+  f64 Step(i32 from, i32 to, f64) const { return abs(gs->heightmap[to] - gs->heightmap[from]); }
+};
+
+// distance, made dearer by the slope (in degrees) of the cell stepped onto
+struct SlopeCost
+{
+  GameState *gs;
+  bool Passable(i32 index) const { return !IsForestedOrWater(index, gs); }
+  f64 Step(i32, i32 to, f64 length) const { return length * (1.0 + gs->slopemap[to] / 10.0); }
+};
+
+// distance, made dearer by wet ground
+struct MoistureCost
+{
+  GameState *gs;
+  bool Passable(i32 index) const { return !IsForestedOrWater(index, gs); }
+  f64 Step(i32, i32 to, f64 length) const { return length * (1.0 + gs->watermap[to] / 64.0); }
+};
+
+// distance, priced by the biome stepped onto
+struct BiomeCost
+{
+  GameState *gs;
+  bool Passable(i32 index) const { return !IsForestedOrWater(index, gs); }
+  f64 Step(i32, i32 to, f64 length) const { return length * BIOME_COST[gs->biomemap[to]]; }
+};
+
+// Heuristics -------------------------------------------------------------------
+
+struct ManhattanHeuristic
+{
+  i32 goalX, goalY;
+  void SetGoal(i32, i32 x, i32 y) { goalX = x; goalY = y; }
+  f64 Estimate(i32, i32 x, i32 y) const { return (f64)abs(x - goalX) + (f64)abs(y - goalY); }
+};
+
+struct OctileHeuristic
+{
+  i32 goalX, goalY;
+  void SetGoal(i32, i32 x, i32 y) { goalX = x; goalY = y; }
+  f64 Estimate(i32, i32 x, i32 y) const
+  {
+    f64 dx = abs(x - goalX);
+    f64 dy = abs(y - goalY);
+    return (dx + dy) + (1.41421356237 - 2.0) * min(dx, dy);
+  }
+};
+
+// only a bound for HeightCost, the tables are built with Weight()
+struct LandmarkBound
+{
+  GameState *gs;
+  i32 goal;
+  void SetGoal(i32 index, i32, i32) { goal = index; }
+  f64 Estimate(i32 index, i32, i32) const { return LandmarkHeuristic(index, goal, gs); }
+};
+
+// Search -----------------------------------------------------------------------
+
+// The per cell arrays are kept between searches. A cell's entries only count
+// when its stamp matches the current search, so nothing is cleared per query.
+template<typename Cost, typename Heuristic, typename Connectivity,
+         typename Queue = PriorityQueue<i32, f64> >
+struct GridSearch
+{
+  Cost cost;
+  Heuristic heuristic;
+  i32 width;
+  i32 height;
+  u32 expansions;
+
+  vector<i32> from;
+  vector<f64> pathCost;
+  vector<u32> seen;    // pathCost and from are valid when equal to stamp
+  vector<u32> closed;  // expanded with its current pathCost when equal to stamp
+  u32 stamp;
+  i32 start;
+  i32 goal;
+  i32 offsets[Connectivity::count];
+  Queue frontier;
+
+  GridSearch() : width(0), height(0), expansions(0), stamp(0), start(0), goal(0) {}
+
+  // Sets the map and policies for the next searches, the arrays only grow
+  void Prepare(Cost c, Heuristic h, i32 w, i32 hgt)
+  {
+    cost = c;
+    heuristic = h;
+    width = w;
+    height = hgt;
+    if(seen.size() < (size_t)(w * hgt))
+    {
+      from.resize(w * hgt);
+      pathCost.resize(w * hgt);
+      seen.assign(w * hgt, 0);
+      closed.assign(w * hgt, 0);
+      stamp = 0;
+    }
+  }
+
+  bool Passable(i32 x, i32 y) const
+  {
+    return x >= 0 && y >= 0 && x < width && y < height && cost.Passable(y * width + x);
+  }
+
+  // same corner rule as CanStep()
+  bool CanStep(i32 x, i32 y, i32 k) const
+  {
+    i32 dx = Connectivity::dx[k];
+    i32 dy = Connectivity::dy[k];
+    if(!Passable(x + dx, y + dy)){
+      return false;
+    }
+    if(dx != 0 && dy != 0){
+      return Passable(x + dx, y) && Passable(x, y + dy);
+    }
+    return true;
+  }
+
+  // Expands the cheapest open cell's neighbors
+  void Relax(i32 curI)
+  {
+    i32 curX = curI % width;
+    i32 curY = curI / width;
+    for(i32 k = 0; k < Connectivity::count; k++)
+    {
+      if(!CanStep(curX, curY, k)){
+        continue;
+      }
+      i32 nextI = curI + offsets[k];
+      f64 newCost = pathCost[curI] + cost.Step(curI, nextI, Connectivity::length[k]);
+      if(seen[nextI] != stamp || newCost < pathCost[nextI])
+      {
+        seen[nextI] = stamp;
+        pathCost[nextI] = newCost;
+        from[nextI] = curI;
+        closed[nextI] = 0;
+        frontier.put(nextI, newCost + heuristic.Estimate(nextI, curX + Connectivity::dx[k], curY + Connectivity::dy[k]));
+      }
+    }
+  }
+
+  // Begins a search, false when the goal can't be reached at all
+  bool Start(i32 startI, i32 goalI)
+  {
+    stamp += 1;
+    if(stamp == 0)
+    {
+      fill(seen.begin(), seen.end(), 0);
+      fill(closed.begin(), closed.end(), 0);
+      stamp = 1;
+    }
+    start = startI;
+    goal = goalI;
+    expansions = 0;
+    frontier = Queue();
+
+    // a blocked goal can never be stepped onto
+    if(!cost.Passable(goal)){
+      return false;
+    }
+    i32 goalX = goal % width;
+    i32 goalY = goal / width;
+    heuristic.SetGoal(goal, goalX, goalY);
+    if(heuristic.Estimate(start, start % width, start / width) == INFINITY){
+      return false;
+    }
+
+    for(i32 k = 0; k < Connectivity::count; k++){
+      offsets[k] = Connectivity::dy[k] * width + Connectivity::dx[k];
+    }
+    frontier.put(start, 0.0);
+    from[start] = start;
+    pathCost[start] = 0.0;
+    seen[start] = stamp;
+    return true;
+  }
+
+  // Expands until the goal is reached or the frontier runs dry
+  bool Continue()
+  {
+    while(!frontier.empty())
+    {
+      i32 curI = frontier.get();
+      if(closed[curI] == stamp){
+        continue;
+      }
+      closed[curI] = stamp;
+      expansions += 1;
+      if(curI == goal){
+        return true;
+      }
+      Relax(curI);
+    }
+    return false;
+  }
+
+  // Fills `path` with the cells from start to goal, empty when unreachable
+  void Finish(bool goalFound, list<int> *path, f64 *outCost)
+  {
+    path->clear();
+    *outCost = INFINITY;
+    if(!goalFound){
+      return;
+    }
+    for(i32 tmp = goal; ; tmp = from[tmp])
+    {
+      path->push_front(tmp);
+      if(tmp == start){
+        break;
+      }
+    }
+    *outCost = pathCost[goal];
+  }
+
+  bool Run(i32 startI, i32 goalI, list<int> *path, f64 *outCost)
+  {
+    bool goalFound = Start(startI, goalI) && Continue();
+    Finish(goalFound, path, outCost);
+    return goalFound;
+  }
+};
+
+// Runs one query through the calling thread's workspace for this
+// instantiation
+template<typename Cost, typename Heuristic, typename Connectivity>
+void RunGridSearch(Cost cost, Heuristic heuristic, GameState *gs)
+{
+  static thread_local GridSearch<Cost, Heuristic, Connectivity> search;
+  search.Prepare(cost, heuristic, gs->map_width, gs->map_height);
+  delete gs->path;
+  gs->path = new list<int>();
+  search.Run(Index(gs->player_pos, gs->map_width), Index(gs->target_pos, gs->map_width),
+    gs->path, &gs->path_cost);
+  gs->search_expansions = search.expansions;
+}
+
+// Picks the instantiation matching the settings, once per query rather than
+// per node
+template<typename Cost>
+void RunGridSearch(Cost cost, bool landmarks, GameState *gs)
+{
+  bool four = (gs->search_mode == SEARCH_4DIR);
+  if(landmarks)
+  {
+    LandmarkBound h = {gs, 0};
+    if(four) RunGridSearch<Cost, LandmarkBound, FourConnected>(cost, h, gs);
+    else RunGridSearch<Cost, LandmarkBound, EightConnected>(cost, h, gs);
+  }
+  else
+  {
+    if(four) RunGridSearch<Cost, ManhattanHeuristic, FourConnected>(cost, ManhattanHeuristic(), gs);
+    else RunGridSearch<Cost, OctileHeuristic, EightConnected>(cost, OctileHeuristic(), gs);
+  }
+}
+
+// Grid mode search honouring gs->cost_model, the other search modes fall
+// back to 8-dir. The landmark tables only bound the height cost. Callers
+// check SearchSupported() (astar.h) so no query asks for what doesn't run.
+void GridAStar(GameState *gs)
+{
+  if(gs->search_log){
+    printf("Start: %d, %d\n", (i32)gs->player_pos.x, (i32)gs->player_pos.y);
+    printf("Target: %d, %d\n", (i32)gs->target_pos.x, (i32)gs->target_pos.y);
+  }
+  bool landmarks = gs->use_landmarks && gs->num_landmarks > 0;
+  if(gs->cost_model == COST_SLOPE)
+  {
+    SlopeCost cost = {gs};
+    RunGridSearch(cost, false, gs);
+  }
+  else if(gs->cost_model == COST_MOISTURE)
+  {
+    MoistureCost cost = {gs};
+    RunGridSearch(cost, false, gs);
+  }
+  else if(gs->cost_model == COST_BIOME)
+  {
+    BiomeCost cost = {gs};
+    RunGridSearch(cost, false, gs);
+  }
+  else
+  {
+    HeightCost cost = {gs};
+    RunGridSearch(cost, landmarks, gs);
+  }
+  if(gs->search_log){
+    printf("Path nodes: %d, cost: %f, expanded: %d\n", (i32)gs->path->size(), gs->path_cost, gs->search_expansions);
+  }
+}
+
+#endif
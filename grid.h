@@ -0,0 +1,104 @@
+#ifndef GRID_H
+#define GRID_H
+
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+
+#include "proc-gen.h"
+
+// Grid helpers shared by the path searches: passability, step costs and
+// straight line traversal over the map cells.
+
+using namespace std;
+
+// neighbor order: left, right, up, down, then the diagonals
+const i32 NEIGHBOR_DX[8] = {-1, 1,  0, 0, -1,  1, -1, 1};
+const i32 NEIGHBOR_DY[8] = { 0, 0, -1, 1, -1, -1,  1, 1};
+// opposite of each neighbor in the same order
+const u8 NEIGHBOR_OPPOSITE[8] = {1, 0, 3, 2, 7, 6, 5, 4};
+
+i32 Index(Vector2 xy, i32 width)
+{
+  return xy.y * width + xy.x;
+}
+
+bool IsForestedOrWater(i32 index, GameState *gs){
+  if(gs->heightmap[index] < 200){
+   return true;
+  }
+  if(gs->forestmap[index] == 1){
+    return true;
+  }
+  return false;
+}
+
+bool IsBlocked(i32 x, i32 y, GameState *gs){
+  if(x < 0 || y < 0 || x >= (i32)gs->map_width || y >= (i32)gs->map_height){
+    return true;
+  }
+  return IsForestedOrWater(y * gs->map_width + x, gs);
+}
+
+// a diagonal step may not cut the corner of a blocked cell
+bool CanStep(i32 x, i32 y, i32 dx, i32 dy, GameState *gs){
+  if(IsBlocked(x + dx, y + dy, gs)){
+    return false;
+  }
+  if(dx != 0 && dy != 0){
+    return !IsBlocked(x + dx, y, gs) && !IsBlocked(x, y + dy, gs);
+  }
+  return true;
+}
+
+double Weight(i32 curI, i32 nextI, GameState *gs){
+  // using the difference height map
+  return abs(gs->heightmap[nextI] - gs->heightmap[curI]);
+}
+
+// rounds a / b to the nearest integer, halves away from zero (b > 0)
+i32 RoundDiv(i32 a, i32 b){
+  return (a >= 0) ? (2 * a + b) / (2 * b) : -((-2 * a + b) / (2 * b));
+}
+
+// Cell number `step` of the straight line from (ax, ay) to (bx, by). Every step
+// moves to one of the 8 neighbors, so a line is walkable exactly when each
+// step passes CanStep.
+i32 LineCell(i32 ax, i32 ay, i32 bx, i32 by, i32 step, i32 width){
+  i32 dx = bx - ax;
+  i32 dy = by - ay;
+  i32 n = max(abs(dx), abs(dy));
+  if(n == 0 || step >= n){
+    return by * width + bx;
+  }
+  return (ay + RoundDiv(dy * step, n)) * width + (ax + RoundDiv(dx * step, n));
+}
+
+// Walks the line between two cells, failing on the first blocked step. The
+// cost of a visible line is the sum of Weight() over its cells, the same as
+// walking it cell by cell.
+bool LineOfSight(i32 fromI, i32 toI, GameState *gs, double *cost){
+  i32 width = gs->map_width;
+  i32 ax = fromI % width, ay = fromI / width;
+  i32 bx = toI % width, by = toI / width;
+  i32 n = max(abs(bx - ax), abs(by - ay));
+
+  double total = 0.0;
+  i32 prevI = fromI;
+  i32 prevX = ax, prevY = ay;
+  for(i32 step = 1; step <= n; step++){
+    i32 cellI = LineCell(ax, ay, bx, by, step, width);
+    i32 cellX = cellI % width, cellY = cellI / width;
+    if(!CanStep(prevX, prevY, cellX - prevX, cellY - prevY, gs)){
+      return false;
+    }
+    total += Weight(prevI, cellI, gs);
+    prevI = cellI;
+    prevX = cellX;
+    prevY = cellY;
+  }
+  *cost = total;
+  return true;
+}
+
+#endif
@@ -0,0 +1,994 @@
+#ifndef HYDROLOGY_H
+#define HYDROLOGY_H
+
+#include <math.h>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+#include "proc-gen.h"
+#include "grid.h"
+#include "worker-pool.h"
+
+// Rain, rivers and erosion over the heightmap. Every land cell drains to one
+// of its 8 neighbors (D8), the rain collected upstream of a cell is its flow,
+// and that flow cuts into the cell in proportion to sqrt(flow) * slope
+// (stream power). Thermal erosion then slides down whatever is steeper than
+// the talus slope. Cells with enough flow are rivers and wet the ground
+// around them, so the forest follows the valleys.
+//
+// The per cell passes run in HYDRO_TILE square tiles handed out to a worker
+// pool kept for the whole simulation, each pass reading one buffer and writing another so tiles never share a
+// cell. Routing the water and adding it up downstream work tile by tile too,
+// with a serial pass over just the tile edges in between to join the tiles.
+//
+// Distances are measured in cells of a HYDRO_REFERENCE_SIZE wide map, so a
+// bigger map gets the same valleys at a finer resolution.
+
+#define SEA_LEVEL 200.0f
+#define HYDRO_SINK 8 // flowdir of cells that drain nowhere: the sea and the map edge
+#define HYDRO_UNROUTED 255
+
+#define HYDRO_TILE 64
+#define HYDRO_PERIMETER (4 * HYDRO_TILE) // more than the cells round a tile's edge
+#define HYDRO_REFERENCE_SIZE 256.0f
+#define HYDRO_ITERATIONS 4
+#define ROUTE_BUCKET_WIDTH 0.25f
+
+#define STREAM_POWER 0.02f    // incision per sqrt(area) * slope
+#define MAX_INCISION 0.5f     // of the drop to the receiver, per iteration
+#define TALUS 32.0f           // steepest stable drop to a neighbor
+#define THERMAL_RATE 0.125f   // share of the excess moved per iteration
+#define LAKE_FILL 0.5f        // of the rise to the outlet silted up per iteration
+#define RIVER_AREA 64.0f      // upstream area of the smallest river
+#define RIVER_BANK 2          // cells either side wetted by a river
+#define RIVER_BANK_FALLOFF 24 // less wetness per cell away from it
+#define RIVER_BANK_MAX_WET 55 // forest grows above this, see GenerateForestMap()
+
+using namespace std;
+
+typedef void (*HydroKernel)(GameState *gs, u32 x0, u32 y0, u32 x1, u32 y1);
+// for kernels that keep something per tile, `context` is shared by all tiles
+typedef void (*TileKernel)(GameState *gs, void *context, u32 tile, u32 x0, u32 y0, u32 x1, u32 y1);
+
+u32 TilesAcross(GameState *gs)
+{
+  return (gs->map_width + HYDRO_TILE - 1) / HYDRO_TILE;
+}
+
+u32 TileCount(GameState *gs)
+{
+  return TilesAcross(gs) * ((gs->map_height + HYDRO_TILE - 1) / HYDRO_TILE);
+}
+
+struct TileBatch
+{
+  GameState *gs;
+  TileKernel kernel;
+  void *context;
+};
+
+void RunTileJob(void *context, u32, u32 t)
+{
+  TileBatch *batch = (TileBatch *)context;
+  GameState *gs = batch->gs;
+  u32 tiles_x = TilesAcross(gs);
+  u32 x0 = (t % tiles_x) * HYDRO_TILE;
+  u32 y0 = (t / tiles_x) * HYDRO_TILE;
+  batch->kernel(gs, batch->context, t, x0, y0, min(x0 + HYDRO_TILE, gs->map_width), min(y0 + HYDRO_TILE, gs->map_height));
+}
+
+// Runs a kernel over every tile of the map, tiles go to whichever worker is
+// free next
+void RunTiles(WorkerPool *pool, GameState *gs, TileKernel kernel, void *context)
+{
+  TileBatch batch = {gs, kernel, context};
+  RunWorkerPool(pool, TileCount(gs), RunTileJob, &batch);
+}
+
+void RunHydroKernel(GameState *gs, void *context, u32, u32 x0, u32 y0, u32 x1, u32 y1)
+{
+  (*(HydroKernel *)context)(gs, x0, y0, x1, y1);
+}
+
+void RunTiles(WorkerPool *pool, GameState *gs, HydroKernel kernel)
+{
+  RunTiles(pool, gs, RunHydroKernel, &kernel);
+}
+
+// Tile holding a map cell
+u32 TileOf(i32 index, GameState *gs)
+{
+  u32 x = index % gs->map_width;
+  u32 y = index / gs->map_width;
+  return (y / HYDRO_TILE) * TilesAcross(gs) + x / HYDRO_TILE;
+}
+
+// Numbers the cells round the edge of the tile a cell is in, below
+// HYDRO_PERIMETER. Only meaningful for cells on that edge.
+u32 PerimeterIndex(i32 index, GameState *gs)
+{
+  u32 x = index % gs->map_width;
+  u32 y = index / gs->map_width;
+  u32 x0 = x / HYDRO_TILE * HYDRO_TILE;
+  u32 y0 = y / HYDRO_TILE * HYDRO_TILE;
+  u32 w = min(x0 + HYDRO_TILE, gs->map_width) - x0;
+  u32 h = min(y0 + HYDRO_TILE, gs->map_height) - y0;
+  x -= x0;
+  y -= y0;
+  if (y == 0) return x;
+  if (y + 1 == h) return w + x;
+  if (x == 0) return 2 * w + y - 1;
+  return 2 * w + h - 2 + y - 1;
+}
+
+bool InTile(i32 x, i32 y, u32 x0, u32 y0, u32 x1, u32 y1)
+{
+  return x >= (i32)x0 && y >= (i32)y0 && x < (i32)x1 && y < (i32)y1;
+}
+
+// Cells off a tile's edge have all 8 neighbors in the tile
+bool OffTileEdge(i32 x, i32 y, u32 x0, u32 y0, u32 x1, u32 y1)
+{
+  return x > (i32)x0 && y > (i32)y0 && x + 1 < (i32)x1 && y + 1 < (i32)y1;
+}
+
+f32 HydroCellSize(GameState *gs)
+{
+  return HYDRO_REFERENCE_SIZE / gs->map_width;
+}
+
+// Map cells off the border have all 8 neighbors, the rest check each one
+bool OnBorder(u32 x, u32 y, GameState *gs)
+{
+  return x == 0 || y == 0 || x + 1 == gs->map_width || y + 1 == gs->map_height;
+}
+
+bool NeighborInMap(u32 x, u32 y, u32 k, GameState *gs)
+{
+  i32 nx = x + NEIGHBOR_DX[k];
+  i32 ny = y + NEIGHBOR_DY[k];
+  return nx >= 0 && ny >= 0 && nx < (i32)gs->map_width && ny < (i32)gs->map_height;
+}
+
+const f32 NEIGHBOR_LENGTH[8] = {1.0f, 1.0f, 1.0f, 1.0f, 1.41421356f, 1.41421356f, 1.41421356f, 1.41421356f};
+
+// The 8 neighbors of a cell in a layer, `outside` for those off the map
+void GatherNeighbors(const f32 *layer, u32 x, u32 y, i32 index, const i32 *offsets,
+                     f32 outside, GameState *gs, f32 *out)
+{
+  if (!OnBorder(x, y, gs))
+  {
+    for (u32 k = 0; k < 8; k++) out[k] = layer[index + offsets[k]];
+    return;
+  }
+  for (u32 k = 0; k < 8; k++)
+  {
+    out[k] = NeighborInMap(x, y, k, gs) ? layer[index + offsets[k]] : outside;
+} }
+
+// The sea drains nowhere. Land on the coast drains into its lowest sea
+// neighbor, land on the map edge off the map. The rest of the land is left
+// HYDRO_UNROUTED for RouteFlow().
+void CoastKernel(GameState *gs, u32 x0, u32 y0, u32 x1, u32 y1)
+{
+  i32 width = gs->map_width;
+  i32 offsets[8];
+  for (u32 k = 0; k < 8; k++) offsets[k] = NEIGHBOR_DY[k] * width + NEIGHBOR_DX[k];
+
+  for (u32 y = y0; y < y1; y++)
+  {
+    for (u32 x = x0; x < x1; x++)
+    {
+      i32 index = y * width + x;
+      u8 dir = HYDRO_SINK;
+      if (gs->heightmap[index] >= SEA_LEVEL && !OnBorder(x, y, gs))
+      {
+        f32 lowest = SEA_LEVEL;
+        dir = HYDRO_UNROUTED;
+        for (u32 k = 0; k < 8; k++)
+        {
+          f32 n = gs->heightmap[index + offsets[k]];
+          if (n < lowest)
+          {
+            lowest = n;
+            dir = k;
+      } } }
+      gs->flowdir[index] = dir;
+} } }
+
+// D8 flow directions that run through pits instead of stopping in them, after
+// Priority-Flood (https://arxiv.org/abs/1511.04463). The land is flooded from
+// the coast inwards, lowest water level first, and each cell drains to the
+// neighbor it would be flooded from. Outside of pits that is its lowest
+// neighbor, in a pit it leads towards the spill point. Water levels are
+// rounded down to ROUTE_BUCKET_WIDTH, so wide flats are common: across one a
+// cell drains towards the nearest way off it.
+//
+// Flooding runs per tile, after Barnes (https://arxiv.org/abs/1606.06204).
+// Each tile floods from its coast and from every cell round its edge, each
+// edge cell carrying its own label. Where two labels meet, in a tile or across
+// the seam between two, is a pass between them. Flooding the small graph of
+// labels and passes from the coast gives the level each label's water really
+// stands at, which settles the level of every cell.
+//
+// A cell with a lower neighbor drains to the lowest. A cell on a flat drains
+// to the neighbor with the lowest (level, flat key), where the key counts the
+// steps from the flat's edge within the tile. Parts of a flat with no edge in
+// their tile count from the seam they drain across instead, keyed higher the
+// more tiles away the edge is. Ties go to the lowest neighbor number, so the
+// result doesn't depend on the order anything ran in.
+
+#define ROUTE_OCEAN 0 // label of the cells flooded from the coast or the map edge
+#define ROUTE_NONE 0xffffffffu
+#define ROUTE_SEA 0xfffffffeu
+#define ROUTE_FRAGMENT 0x80000000u // flat key of a fragment not yet reached, | its number
+#define ROUTE_FLAT_SPAN (HYDRO_TILE * HYDRO_TILE) // more than the steps across a tile
+
+struct RoutePass
+{
+  u32 a, b;  // labels, a < b
+  f32 level; // water level the two meet at
+};
+
+struct RouteTile
+{
+  vector<RoutePass> passes;
+  vector<i32> flats;          // cells with no lower neighbor, drained last
+  vector<i32> fragments;      // flat cells with no way off in the tile, by fragment
+  vector<u32> fragment_first; // where each fragment starts in fragments
+};
+
+struct RouteState
+{
+  // per cell, the label it was flooded from, then once the levels are
+  // settled its flat key
+  vector<u32> label;
+  vector<f32> label_level; // per label
+  vector<RouteTile> tiles;
+};
+
+// Water level rounded down to its bucket, exact in floats
+f32 BucketLevel(f32 h)
+{
+  return floorf(h / ROUTE_BUCKET_WIDTH) * ROUTE_BUCKET_WIDTH;
+}
+
+u32 LevelBucket(f32 level)
+{
+  return (u32)(level / ROUTE_BUCKET_WIDTH);
+}
+
+// Label a tile edge cell floods from, the coast and map edge share one
+u32 EdgeLabel(i32 index, GameState *gs)
+{
+  if (gs->flowdir[index] != HYDRO_UNROUTED) return ROUTE_OCEAN;
+  return 1 + TileOf(index, gs) * HYDRO_PERIMETER + PerimeterIndex(index, gs);
+}
+
+void AddPass(vector<RoutePass> *passes, u32 a, u32 b, f32 level)
+{
+  if (a == b) return;
+  RoutePass pass = {min(a, b), max(a, b), level};
+  passes->push_back(pass);
+}
+
+// Floods a tile from its coast and edge cells, noting the passes between
+// labels inside it and across its right and bottom seams
+void FloodTileKernel(GameState *gs, void *context, u32 tile, u32 x0, u32 y0, u32 x1, u32 y1)
+{
+  RouteState *route = (RouteState *)context;
+  u32 *label = &route->label[0];
+  f32 *level = gs->erosion_scratch;
+  f32 *height = gs->heightmap;
+  i32 width = gs->map_width;
+  i32 offsets[8];
+  for (u32 k = 0; k < 8; k++) offsets[k] = NEIGHBOR_DY[k] * width + NEIGHBOR_DX[k];
+  vector<RoutePass> *passes = &route->tiles[tile].passes;
+  passes->clear();
+
+  // labels flooding inside the tile are the ocean and the tile's own edge
+  // cells, so the lowest pass between each two is kept in a table
+  const u32 labels = HYDRO_PERIMETER + 1;
+  u32 base = tile * HYDRO_PERIMETER;
+  static thread_local vector<f32> lowest_pass(labels * labels, INFINITY);
+  static thread_local vector<u32> met;
+
+  static thread_local vector<vector<i32> > buckets;
+  u32 lowest = ROUTE_NONE;
+  for (u32 y = y0; y < y1; y++)
+  {
+    for (u32 x = x0; x < x1; x++)
+    {
+      i32 index = y * width + x;
+      bool edge = x == x0 || y == y0 || x + 1 == x1 || y + 1 == y1;
+      label[index] = (height[index] < SEA_LEVEL) ? ROUTE_SEA : ROUTE_NONE;
+      if (label[index] == ROUTE_SEA || (!edge && gs->flowdir[index] == HYDRO_UNROUTED)) continue;
+      label[index] = EdgeLabel(index, gs);
+      level[index] = BucketLevel(height[index]);
+      u32 b = LevelBucket(level[index]);
+      if (b >= buckets.size()) buckets.resize(b + 1);
+      buckets[b].push_back(index);
+      lowest = min(lowest, b);
+  } }
+
+  for (u32 b = lowest; b < buckets.size(); b++)
+  {
+    for (u32 c = 0; c < buckets[b].size(); c++)
+    {
+      i32 cur = buckets[b][c];
+      i32 cx = cur % width;
+      i32 cy = cur / width;
+      bool edge = !OffTileEdge(cx, cy, x0, y0, x1, y1);
+      u32 own = label[cur];
+      for (u32 k = 0; k < 8; k++)
+      {
+        if (edge && !InTile(cx + NEIGHBOR_DX[k], cy + NEIGHBOR_DY[k], x0, y0, x1, y1)) continue;
+        i32 next = cur + offsets[k];
+        u32 other = label[next];
+        if (other == ROUTE_NONE)
+        {
+          label[next] = own;
+          level[next] = max(BucketLevel(height[next]), level[cur]);
+          u32 nb = LevelBucket(level[next]);
+          if (nb >= buckets.size()) buckets.resize(nb + 1);
+          buckets[nb].push_back(next);
+        }
+        else if (other != own && other != ROUTE_SEA)
+        {
+          u32 la = own ? own - base : 0;
+          u32 lb = other ? other - base : 0;
+          u32 slot = min(la, lb) * labels + max(la, lb);
+          if (lowest_pass[slot] == INFINITY) met.push_back(slot);
+          lowest_pass[slot] = min(lowest_pass[slot], max(level[cur], level[next]));
+    } } }
+    buckets[b].clear();
+  }
+  for (u32 m = 0; m < met.size(); m++)
+  {
+    u32 la = met[m] / labels;
+    u32 lb = met[m] % labels;
+    AddPass(passes, la ? base + la : 0, lb ? base + lb : 0, lowest_pass[met[m]]);
+    lowest_pass[met[m]] = INFINITY;
+  }
+  met.clear();
+
+  // edge cells keep the level of their own ground, so the seams need nothing
+  // from the neighboring tiles' floods
+  for (u32 y = y0; y < y1; y++)
+  {
+    for (u32 x = x0; x < x1; x++)
+    {
+      bool right = (x + 1 == x1 && x1 < gs->map_width);
+      bool bottom = (y + 1 == y1 && y1 < gs->map_height);
+      i32 index = y * width + x;
+      if ((!right && !bottom) || label[index] == ROUTE_SEA) continue;
+      for (u32 k = 0; k < 8; k++)
+      {
+        i32 nx = x + NEIGHBOR_DX[k];
+        i32 ny = y + NEIGHBOR_DY[k];
+        if (!(right && nx == (i32)x1) && !(bottom && ny == (i32)y1)) continue;
+        if (nx >= (i32)gs->map_width || ny < 0 || ny >= (i32)gs->map_height) continue;
+        i32 next = index + offsets[k];
+        if (height[next] < SEA_LEVEL) continue;
+        AddPass(passes, label[index], EdgeLabel(next, gs), max(level[index], BucketLevel(height[next])));
+} } } }
+
+// Floods the graph of labels and passes from the coast, lowest level first
+void FloodLabels(RouteState *route, u32 labels)
+{
+  vector<u32> first(labels + 1, 0);
+  for (u32 t = 0; t < route->tiles.size(); t++)
+  {
+    const vector<RoutePass> &passes = route->tiles[t].passes;
+    for (u32 p = 0; p < passes.size(); p++)
+    {
+      first[passes[p].a + 1] += 1;
+      first[passes[p].b + 1] += 1;
+  } }
+  for (u32 l = 0; l < labels; l++) first[l + 1] += first[l];
+  vector<u32> fill(first.begin(), first.end() - 1);
+  vector<u32> across(first[labels]);
+  vector<f32> at(first[labels]);
+  for (u32 t = 0; t < route->tiles.size(); t++)
+  {
+    const vector<RoutePass> &passes = route->tiles[t].passes;
+    for (u32 p = 0; p < passes.size(); p++)
+    {
+      across[fill[passes[p].a]] = passes[p].b;
+      at[fill[passes[p].a]++] = passes[p].level;
+      across[fill[passes[p].b]] = passes[p].a;
+      at[fill[passes[p].b]++] = passes[p].level;
+  } }
+
+  vector<f32> &level = route->label_level;
+  level.assign(labels, INFINITY);
+  level[ROUTE_OCEAN] = 0.0f;
+  vector<vector<u32> > buckets(1, vector<u32>(1, ROUTE_OCEAN));
+  for (u32 b = 0; b < buckets.size(); b++)
+  {
+    for (u32 c = 0; c < buckets[b].size(); c++)
+    {
+      u32 cur = buckets[b][c];
+      for (u32 e = first[cur]; e < first[cur + 1]; e++)
+      {
+        f32 next_level = max(level[cur], at[e]);
+        if (next_level >= level[across[e]]) continue;
+        level[across[e]] = next_level;
+        u32 nb = LevelBucket(next_level);
+        if (nb >= buckets.size()) buckets.resize(nb + 1);
+        buckets[nb].push_back(across[e]);
+    } }
+    vector<u32>().swap(buckets[b]);
+} }
+
+// Raises each cell to the level its label's water stands at
+void SettleLevelKernel(GameState *gs, void *context, u32, u32 x0, u32 y0, u32 x1, u32 y1)
+{
+  RouteState *route = (RouteState *)context;
+  for (u32 y = y0; y < y1; y++)
+  {
+    for (u32 x = x0; x < x1; x++)
+    {
+      i32 index = y * gs->map_width + x;
+      u32 l = route->label[index];
+      if (l != ROUTE_SEA) gs->erosion_scratch[index] = max(gs->erosion_scratch[index], route->label_level[l]);
+} } }
+
+// Drains the cells with a lower neighbor, then keys each flat cell by its
+// steps from the flat's edge within the tile. The rest of each flat is split
+// into fragments, connected within the tile, for LinkFragments().
+void FlatKeyKernel(GameState *gs, void *context, u32 tile, u32 x0, u32 y0, u32 x1, u32 y1)
+{
+  RouteState *route = (RouteState *)context;
+  RouteTile *rt = &route->tiles[tile];
+  u32 *key = &route->label[0];
+  const f32 *level = gs->erosion_scratch;
+  i32 width = gs->map_width;
+  i32 offsets[8];
+  for (u32 k = 0; k < 8; k++) offsets[k] = NEIGHBOR_DY[k] * width + NEIGHBOR_DX[k];
+
+  static thread_local vector<i32> queue;
+  queue.clear();
+  rt->flats.clear();
+  for (u32 y = y0; y < y1; y++)
+  {
+    for (u32 x = x0; x < x1; x++)
+    {
+      i32 index = y * width + x;
+      if (key[index] == ROUTE_SEA) continue;
+      if (gs->flowdir[index] == HYDRO_UNROUTED)
+      {
+        // unrouted cells are off the map border with only land around them
+        u8 dir = 0;
+        for (u32 k = 1; k < 8; k++)
+        {
+          if (level[index + offsets[k]] < level[index + offsets[dir]]) dir = k;
+        }
+        if (level[index + offsets[dir]] >= level[index])
+        {
+          key[index] = ROUTE_NONE;
+          rt->flats.push_back(index);
+          continue;
+        }
+        gs->flowdir[index] = dir;
+      }
+      key[index] = 0;
+      queue.push_back(index);
+  } }
+
+  for (u32 q = 0; q < queue.size(); q++)
+  {
+    i32 cur = queue[q];
+    i32 cx = cur % width;
+    i32 cy = cur / width;
+    bool edge = !OffTileEdge(cx, cy, x0, y0, x1, y1);
+    for (u32 k = 0; k < 8; k++)
+    {
+      if (edge && !InTile(cx + NEIGHBOR_DX[k], cy + NEIGHBOR_DY[k], x0, y0, x1, y1)) continue;
+      i32 next = cur + offsets[k];
+      if (key[next] != ROUTE_NONE || level[next] != level[cur]) continue;
+      key[next] = key[cur] + 1;
+      queue.push_back(next);
+  } }
+
+  rt->fragments.clear();
+  rt->fragment_first.clear();
+  for (u32 f = 0; f < rt->flats.size(); f++)
+  {
+    i32 start = rt->flats[f];
+    if (key[start] != ROUTE_NONE) continue;
+    u32 fragment = ROUTE_FRAGMENT | rt->fragment_first.size();
+    rt->fragment_first.push_back(rt->fragments.size());
+    key[start] = fragment;
+    rt->fragments.push_back(start);
+    for (u32 q = rt->fragment_first.back(); q < rt->fragments.size(); q++)
+    {
+      i32 cur = rt->fragments[q];
+      i32 cx = cur % width;
+      i32 cy = cur / width;
+      for (u32 k = 0; k < 8; k++)
+      {
+        if (!InTile(cx + NEIGHBOR_DX[k], cy + NEIGHBOR_DY[k], x0, y0, x1, y1)) continue;
+        i32 next = cur + offsets[k];
+        if (key[next] != ROUTE_NONE || level[next] != level[cur]) continue;
+        key[next] = fragment;
+        rt->fragments.push_back(next);
+  } } }
+  rt->fragment_first.push_back(rt->fragments.size());
+}
+
+// Counts how many tiles each fragment is from a way off its flat, over the
+// seams it shares with other tiles, and keys the fragment cells on those
+// seams that are one tile nearer
+void LinkFragments(GameState *gs, RouteState *route)
+{
+  u32 *key = &route->label[0];
+  const f32 *level = gs->erosion_scratch;
+  i32 width = gs->map_width;
+  i32 offsets[8];
+  for (u32 k = 0; k < 8; k++) offsets[k] = NEIGHBOR_DY[k] * width + NEIGHBOR_DX[k];
+
+  u32 tiles = route->tiles.size();
+  vector<u32> first(tiles + 1, 0);
+  for (u32 t = 0; t < tiles; t++) first[t + 1] = first[t] + route->tiles[t].fragment_first.size() - 1;
+  u32 fragments = first[tiles];
+  if (fragments == 0) return;
+
+  // fragments meeting across a seam, and the ones touching a keyed flat cell
+  vector<pair<u32, u32> > links;
+  vector<u32> distance(fragments, ROUTE_NONE);
+  vector<u32> queue;
+  for (u32 t = 0; t < tiles; t++)
+  {
+    const RouteTile &rt = route->tiles[t];
+    for (u32 c = 0; c < rt.fragments.size(); c++)
+    {
+      i32 cell = rt.fragments[c];
+      u32 from = first[t] + (key[cell] & ~ROUTE_FRAGMENT);
+      for (u32 k = 0; k < 8; k++)
+      {
+        i32 next = cell + offsets[k];
+        if (level[next] != level[cell] || TileOf(next, gs) == t) continue;
+        if (!(key[next] & ROUTE_FRAGMENT))
+        {
+          if (distance[from] == ROUTE_NONE) queue.push_back(from);
+          distance[from] = 1;
+          continue;
+        }
+        links.push_back(pair<u32, u32>(from, first[TileOf(next, gs)] + (key[next] & ~ROUTE_FRAGMENT)));
+  } } }
+  sort(links.begin(), links.end());
+  links.erase(unique(links.begin(), links.end()), links.end());
+  vector<u32> link_first(fragments + 1, 0);
+  for (u32 l = 0; l < links.size(); l++) link_first[links[l].first + 1] += 1;
+  for (u32 f = 0; f < fragments; f++) link_first[f + 1] += link_first[f];
+  for (u32 q = 0; q < queue.size(); q++)
+  {
+    u32 cur = queue[q];
+    for (u32 l = link_first[cur]; l < link_first[cur + 1]; l++)
+    {
+      u32 next = links[l].second;
+      if (distance[next] != ROUTE_NONE) continue;
+      distance[next] = distance[cur] + 1;
+      queue.push_back(next);
+  } }
+
+  // keys are only written once every seam has been read
+  vector<pair<i32, u32> > seeds;
+  for (u32 t = 0; t < tiles; t++)
+  {
+    const RouteTile &rt = route->tiles[t];
+    for (u32 c = 0; c < rt.fragments.size(); c++)
+    {
+      i32 cell = rt.fragments[c];
+      u32 d = distance[first[t] + (key[cell] & ~ROUTE_FRAGMENT)];
+      for (u32 k = 0; k < 8; k++)
+      {
+        i32 next = cell + offsets[k];
+        if (level[next] != level[cell] || TileOf(next, gs) == t) continue;
+        u32 nd = (key[next] & ROUTE_FRAGMENT) ? distance[first[TileOf(next, gs)] + (key[next] & ~ROUTE_FRAGMENT)] : 0;
+        if (nd + 1 == d)
+        {
+          seeds.push_back(pair<i32, u32>(cell, d * ROUTE_FLAT_SPAN));
+          break;
+  } } } }
+  for (u32 s = 0; s < seeds.size(); s++) key[seeds[s].first] = seeds[s].second;
+}
+
+// Keys the rest of each fragment by its steps from the seams LinkFragments()
+// keyed
+void FragmentKeyKernel(GameState *gs, void *context, u32 tile, u32 x0, u32 y0, u32 x1, u32 y1)
+{
+  RouteState *route = (RouteState *)context;
+  const RouteTile *rt = &route->tiles[tile];
+  u32 *key = &route->label[0];
+  const f32 *level = gs->erosion_scratch;
+  i32 width = gs->map_width;
+
+  static thread_local vector<i32> queue;
+  queue.clear();
+  for (u32 c = 0; c < rt->fragments.size(); c++)
+  {
+    if (!(key[rt->fragments[c]] & ROUTE_FRAGMENT)) queue.push_back(rt->fragments[c]);
+  }
+  for (u32 q = 0; q < queue.size(); q++)
+  {
+    i32 cur = queue[q];
+    i32 cx = cur % width;
+    i32 cy = cur / width;
+    for (u32 k = 0; k < 8; k++)
+    {
+      if (!InTile(cx + NEIGHBOR_DX[k], cy + NEIGHBOR_DY[k], x0, y0, x1, y1)) continue;
+      i32 next = cur + NEIGHBOR_DY[k] * width + NEIGHBOR_DX[k];
+      if (!(key[next] & ROUTE_FRAGMENT) || key[next] == ROUTE_SEA || level[next] != level[cur]) continue;
+      key[next] = key[cur] + 1;
+      queue.push_back(next);
+} } }
+
+// Drains each flat cell to the neighbor with the lowest level and then key,
+// which is lower in one or the other
+void DrainFlatsKernel(GameState *gs, void *context, u32 tile, u32, u32, u32, u32)
+{
+  RouteState *route = (RouteState *)context;
+  const vector<i32> &flats = route->tiles[tile].flats;
+  const u32 *key = &route->label[0];
+  const f32 *level = gs->erosion_scratch;
+  i32 width = gs->map_width;
+  i32 offsets[8];
+  for (u32 k = 0; k < 8; k++) offsets[k] = NEIGHBOR_DY[k] * width + NEIGHBOR_DX[k];
+
+  for (u32 f = 0; f < flats.size(); f++)
+  {
+    i32 index = flats[f];
+    u8 dir = 0;
+    for (u32 k = 1; k < 8; k++)
+    {
+      i32 best = index + offsets[dir];
+      i32 next = index + offsets[k];
+      if (level[next] < level[best] || (level[next] == level[best] && key[next] < key[best])) dir = k;
+    }
+    gs->flowdir[index] = dir;
+} }
+
+void RouteFlow(WorkerPool *pool, GameState *gs)
+{
+  RunTiles(pool, gs, CoastKernel);
+
+  u32 tiles = TileCount(gs);
+  RouteState route;
+  route.label.resize(gs->map_width * gs->map_height);
+  route.tiles.resize(tiles);
+  RunTiles(pool, gs, FloodTileKernel, &route);
+  FloodLabels(&route, 1 + tiles * HYDRO_PERIMETER);
+  RunTiles(pool, gs, SettleLevelKernel, &route);
+  RunTiles(pool, gs, FlatKeyKernel, &route);
+  LinkFragments(gs, &route);
+  RunTiles(pool, gs, FragmentKeyKernel, &route);
+  RunTiles(pool, gs, DrainFlatsKernel, &route);
+}
+
+// Rain falling on each cell in reference cells of area, wetter ground gets
+// more of it. Also counts the neighbors in the same tile draining into each
+// cell, kept in rivermap until the rivers are drawn.
+void RainKernel(GameState *gs, u32 x0, u32 y0, u32 x1, u32 y1)
+{
+  i32 width = gs->map_width;
+  i32 offsets[8];
+  for (u32 k = 0; k < 8; k++) offsets[k] = NEIGHBOR_DY[k] * width + NEIGHBOR_DX[k];
+  f32 area = HydroCellSize(gs) * HydroCellSize(gs);
+
+  for (u32 y = y0; y < y1; y++)
+  {
+    for (u32 x = x0; x < x1; x++)
+    {
+      i32 index = y * width + x;
+      gs->flowmap[index] = area * (0.5f + gs->watermap[index] / 255.0f);
+
+      u8 donors = 0;
+      bool edge = !OffTileEdge(x, y, x0, y0, x1, y1);
+      for (u32 k = 0; k < 8; k++)
+      {
+        if (edge && !InTile(x + NEIGHBOR_DX[k], y + NEIGHBOR_DY[k], x0, y0, x1, y1)) continue;
+        donors += (gs->flowdir[index + offsets[k]] == NEIGHBOR_OPPOSITE[k]);
+      }
+      gs->rivermap[index] = donors;
+} } }
+
+struct FlowState
+{
+  vector<vector<i32> > outlets;  // per tile, cells draining out of it
+  vector<vector<i32> > exits;    // per tile by PerimeterIndex(), the outlet the
+                                 // water from that edge cell leaves by, or -1
+  vector<vector<pair<i32, f32> > > inflows; // per tile, flow coming in and where
+};
+
+// Adds up the flow inside a tile, a cell passing its flow on once all its
+// donors in the tile have. Then works out which outlet the water reaching
+// each edge cell leaves the tile by.
+void AccumulateTileKernel(GameState *gs, void *context, u32 tile, u32 x0, u32 y0, u32 x1, u32 y1)
+{
+  FlowState *state = (FlowState *)context;
+  u8 *pending = gs->rivermap;
+  u8 *flowdir = gs->flowdir;
+  f32 *flow = gs->flowmap;
+  i32 width = gs->map_width;
+  i32 offsets[8];
+  for (u32 k = 0; k < 8; k++) offsets[k] = NEIGHBOR_DY[k] * width + NEIGHBOR_DX[k];
+
+  // cells in the order they passed their flow on, downstream after upstream
+  static thread_local vector<i32> order;
+  order.clear();
+  for (u32 y = y0; y < y1; y++)
+  {
+    for (u32 x = x0; x < x1; x++)
+    {
+      i32 cur = y * width + x;
+      while (pending[cur] == 0)
+      {
+        pending[cur] = 255; // done
+        order.push_back(cur);
+        u8 d = flowdir[cur];
+        if (d == HYDRO_SINK) break;
+        if (!InTile(cur % width + NEIGHBOR_DX[d], cur / width + NEIGHBOR_DY[d], x0, y0, x1, y1)) break;
+        i32 next = cur + offsets[d];
+        flow[next] += flow[cur];
+        pending[next] -= 1;
+        cur = next;
+  } } }
+
+  // walked back, each cell's receiver has its exit worked out already
+  static thread_local vector<i32> exit;
+  exit.resize(HYDRO_TILE * HYDRO_TILE);
+  u32 tile_width = x1 - x0;
+  vector<i32> *outlets = &state->outlets[tile];
+  vector<i32> *exits = &state->exits[tile];
+  outlets->clear();
+  exits->assign(HYDRO_PERIMETER, -1);
+  for (u32 i = order.size(); i-- > 0;)
+  {
+    i32 cur = order[i];
+    i32 cx = cur % width;
+    i32 cy = cur / width;
+    i32 local = (cy - y0) * tile_width + (cx - x0);
+    u8 d = flowdir[cur];
+    if (d == HYDRO_SINK)
+    {
+      exit[local] = -1;
+    }
+    else if (!InTile(cx + NEIGHBOR_DX[d], cy + NEIGHBOR_DY[d], x0, y0, x1, y1))
+    {
+      exit[local] = outlets->size();
+      outlets->push_back(cur);
+    }
+    else
+    {
+      exit[local] = exit[local + NEIGHBOR_DY[d] * tile_width + NEIGHBOR_DX[d]];
+    }
+    if (cx == (i32)x0 || cy == (i32)y0 || cx + 1 == (i32)x1 || cy + 1 == (i32)y1)
+    {
+      (*exits)[PerimeterIndex(cur, gs)] = exit[local];
+} } }
+
+// Carries the flow leaving each tile into the next one. An outlet passes its
+// flow on once everything entering its tile upstream of it has arrived.
+void CarryFlowBetweenTiles(GameState *gs, FlowState *state)
+{
+  u32 tiles = state->outlets.size();
+  vector<u32> first(tiles + 1, 0);
+  for (u32 t = 0; t < tiles; t++) first[t + 1] = first[t] + state->outlets[t].size();
+
+  u32 outlets = first[tiles];
+  vector<i32> receiver(outlets);
+  vector<i32> downstream(outlets); // the outlet its flow leaves the next tile by, or -1
+  vector<f32> carried(outlets);
+  vector<u32> waiting(outlets, 0);
+  for (u32 t = 0; t < tiles; t++)
+  {
+    for (u32 o = 0; o < state->outlets[t].size(); o++)
+    {
+      i32 cell = state->outlets[t][o];
+      i32 r = cell + NEIGHBOR_DY[gs->flowdir[cell]] * (i32)gs->map_width + NEIGHBOR_DX[gs->flowdir[cell]];
+      u32 rt = TileOf(r, gs);
+      i32 e = state->exits[rt][PerimeterIndex(r, gs)];
+      u32 id = first[t] + o;
+      receiver[id] = r;
+      downstream[id] = (e < 0) ? -1 : (i32)(first[rt] + e);
+      carried[id] = gs->flowmap[cell];
+      if (e >= 0) waiting[downstream[id]] += 1;
+  } }
+
+  vector<u32> ready;
+  for (u32 id = 0; id < outlets; id++)
+  {
+    if (waiting[id] == 0) ready.push_back(id);
+  }
+  for (u32 q = 0; q < ready.size(); q++)
+  {
+    u32 id = ready[q];
+    state->inflows[TileOf(receiver[id], gs)].push_back(pair<i32, f32>(receiver[id], carried[id]));
+    i32 d = downstream[id];
+    if (d < 0) continue;
+    carried[d] += carried[id];
+    if (--waiting[d] == 0) ready.push_back(d);
+} }
+
+// Adds the flow coming into a tile to every cell downstream of where it comes
+// in, up to where it leaves
+void InflowKernel(GameState *gs, void *context, u32 tile, u32 x0, u32 y0, u32 x1, u32 y1)
+{
+  FlowState *state = (FlowState *)context;
+  i32 width = gs->map_width;
+  vector<pair<i32, f32> > *inflows = &state->inflows[tile];
+  for (u32 i = 0; i < inflows->size(); i++)
+  {
+    i32 cur = (*inflows)[i].first;
+    f32 amount = (*inflows)[i].second;
+    for (;;)
+    {
+      gs->flowmap[cur] += amount;
+      u8 d = gs->flowdir[cur];
+      if (d == HYDRO_SINK || !InTile(cur % width + NEIGHBOR_DX[d], cur / width + NEIGHBOR_DY[d], x0, y0, x1, y1)) break;
+      cur += NEIGHBOR_DY[d] * width + NEIGHBOR_DX[d];
+} } }
+
+// Adds every cell's rain to all the cells downstream of it: first within each
+// tile, then from tile to tile over just the cells where the water crosses a
+// seam, then what came in along each tile's rivers.
+void AccumulateFlow(WorkerPool *pool, GameState *gs)
+{
+  RunTiles(pool, gs, RainKernel);
+
+  u32 tiles = TileCount(gs);
+  FlowState state;
+  state.outlets.resize(tiles);
+  state.exits.resize(tiles);
+  state.inflows.resize(tiles);
+  RunTiles(pool, gs, AccumulateTileKernel, &state);
+  CarryFlowBetweenTiles(gs, &state);
+  RunTiles(pool, gs, InflowKernel, &state);
+}
+
+// Stream power incision, never below the cell drained into or the sea. Cells
+// draining uphill are in a pit, a lake, and silt up towards their outlet.
+void IncisionKernel(GameState *gs, u32 x0, u32 y0, u32 x1, u32 y1)
+{
+  i32 width = gs->map_width;
+  i32 offsets[8];
+  for (u32 k = 0; k < 8; k++) offsets[k] = NEIGHBOR_DY[k] * width + NEIGHBOR_DX[k];
+  f32 cell = HydroCellSize(gs);
+
+  for (u32 y = y0; y < y1; y++)
+  {
+    for (u32 x = x0; x < x1; x++)
+    {
+      i32 index = y * width + x;
+      f32 h = gs->heightmap[index];
+      u8 d = gs->flowdir[index];
+      if (d != HYDRO_SINK)
+      {
+        f32 drop = h - gs->heightmap[index + offsets[d]];
+        if (drop > 0.0f)
+        {
+          f32 slope = drop / (cell * NEIGHBOR_LENGTH[d]);
+          f32 cut = STREAM_POWER * sqrtf(gs->flowmap[index]) * slope;
+          h = max(h - min(cut, MAX_INCISION * drop), SEA_LEVEL);
+        }
+        else
+        {
+          h -= LAKE_FILL * drop;
+      } }
+      gs->erosion_scratch[index] = h;
+} } }
+
+// Moves a share of every drop steeper than the talus from the higher to the
+// lower cell. Each cell sums its own exchanges with its land neighbors, the
+// two sides of a pair see the same drop so no height is lost.
+void ThermalKernel(GameState *gs, u32 x0, u32 y0, u32 x1, u32 y1)
+{
+  i32 width = gs->map_width;
+  i32 offsets[8];
+  f32 limits[8];
+  for (u32 k = 0; k < 8; k++)
+  {
+    offsets[k] = NEIGHBOR_DY[k] * width + NEIGHBOR_DX[k];
+    limits[k] = TALUS * HydroCellSize(gs) * NEIGHBOR_LENGTH[k];
+  }
+
+  for (u32 y = y0; y < y1; y++)
+  {
+    for (u32 x = x0; x < x1; x++)
+    {
+      i32 index = y * width + x;
+      f32 h = gs->heightmap[index];
+      if (h >= SEA_LEVEL)
+      {
+        f32 n[8];
+        GatherNeighbors(gs->heightmap, x, y, index, offsets, h, gs, n);
+        f32 change = 0.0f;
+        for (u32 k = 0; k < 8; k++)
+        {
+          f32 drop = h - n[k];
+          f32 moved = max(-drop - limits[k], 0.0f) - max(drop - limits[k], 0.0f);
+          change += (n[k] >= SEA_LEVEL) ? moved : 0.0f;
+        }
+        h = max(h + THERMAL_RATE / 8.0f * change, SEA_LEVEL);
+      }
+      gs->erosion_scratch[index] = h;
+} } }
+
+// log2(x) for x >= 1, exact at powers of two and linear between them. Built
+// from frexpf(), which is exact, so rivers come out the same on every platform
+// where log2f() may not.
+f32 Log2Linear(f32 x)
+{
+  i32 exponent;
+  f32 mantissa = frexpf(x, &exponent); // x = mantissa * 2^exponent, mantissa in [0.5, 1)
+  return (exponent - 1) + (2.0f * mantissa - 1.0f);
+}
+
+// River strength from the flow, 0 below RIVER_AREA
+void RiverKernel(GameState *gs, u32 x0, u32 y0, u32 x1, u32 y1)
+{
+  for (u32 y = y0; y < y1; y++)
+  {
+    for (u32 x = x0; x < x1; x++)
+    {
+      i32 index = y * gs->map_width + x;
+      f32 flow = gs->flowmap[index];
+      u8 river = 0;
+      if (gs->heightmap[index] >= SEA_LEVEL && flow >= RIVER_AREA)
+      {
+        river = (u8)min(64.0f + 32.0f * Log2Linear(flow / RIVER_AREA), 255.0f);
+      }
+      gs->rivermap[index] = river;
+} } }
+
+// The ground around a river gets wetter the bigger the river and the closer
+// it is. River cells are few, so this one runs serially over just them.
+void WetRiverBanks(GameState *gs)
+{
+  i32 width = gs->map_width;
+  i32 height = gs->map_height;
+  for (i32 y = 0; y < height; y++)
+  {
+    for (i32 x = 0; x < width; x++)
+    {
+      u8 river = gs->rivermap[y * width + x];
+      if (!river) continue;
+      for (i32 ny = max(y - RIVER_BANK, 0); ny <= min(y + RIVER_BANK, height - 1); ny++)
+      {
+        for (i32 nx = max(x - RIVER_BANK, 0); nx <= min(x + RIVER_BANK, width - 1); nx++)
+        {
+          i32 wet = river - RIVER_BANK_FALLOFF * max(abs(nx - x), abs(ny - y));
+          // the river itself stays wet, its banks only damp so that rivers
+          // don't grow forest walls that cut the map in two
+          if (nx != x || ny != y) wet = min(wet, RIVER_BANK_MAX_WET);
+          u8 *w = &gs->watermap[ny * width + nx];
+          if (wet > *w) *w = wet;
+} } } } }
+
+// Erodes the heightmap and fills flowdir, flowmap and rivermap. Needs the
+// heightmap and watermap, the slope and forest layers are derived afterwards.
+void SimulateHydrology(GameState *gs)
+{
+  WorkerPool pool;
+  StartWorkerPool(&pool, max(thread::hardware_concurrency(), 1u));
+
+  // erosion deepens the valleys the water already runs in rather than moving
+  // it, so the drainage is worked out once on the uneroded terrain
+  RouteFlow(&pool, gs);
+  AccumulateFlow(&pool, gs);
+  for (u32 it = 0; it < HYDRO_ITERATIONS; it++)
+  {
+    RunTiles(&pool, gs, IncisionKernel);
+    swap(gs->heightmap, gs->erosion_scratch);
+    RunTiles(&pool, gs, ThermalKernel);
+    swap(gs->heightmap, gs->erosion_scratch);
+  }
+  RunTiles(&pool, gs, RiverKernel);
+  WetRiverBanks(gs);
+  StopWorkerPool(&pool);
+}
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef LANDMARKS_H
+#define LANDMARKS_H
+
+#include <vector>
+#include <thread>
+#include <math.h>
+
+#include "priority-queue.h"
+#include "proc-gen.h"
+#include "grid.h"
+
+// ALT heuristic (A*, Landmarks and the Triangle inequality), see
+// https://www.microsoft.com/en-us/research/publication/computing-the-shortest-path-a-search-meets-graph-theory/
+// Path costs to a few landmarks bound the cost between any two cells,
+// d(a, b) >= |d(L, b) - d(L, a)|. Weight() is symmetric and the tables are built
+// with 8-dir moves, which are never dearer than 4-dir or any-angle paths, so
+// the bound holds for every search mode.
+
+// landmarks BuildLandmarks() places, AllocateWorld() sizes the tables for
+// this many rather than MAX_LANDMARKS
+#define DEFAULT_LANDMARKS 12
+static_assert(DEFAULT_LANDMARKS <= MAX_LANDMARKS, "landmarks[] holds MAX_LANDMARKS");
+
+using namespace std;
+
+// Dijkstra from one landmark over the whole map
+void LandmarkDijkstra(GameState *gs, i32 source, vector<f32> *dist)
+{
+  i32 width = gs->map_width;
+  PriorityQueue<int, double> frontier;
+  dist->assign(gs->map_width * gs->map_height, INFINITY);
+  (*dist)[source] = 0.0f;
+  frontier.put(source, 0.0);
+
+  while(!frontier.empty())
+  {
+    double curCost = frontier.top_priority();
+    int curI = frontier.get();
+    if(curCost > (*dist)[curI]){
+      continue;
+    }
+    i32 curX = curI % width;
+    i32 curY = curI / width;
+
+    for(i32 k = 0; k < 8; k++)
+    {
+      if(!CanStep(curX, curY, NEIGHBOR_DX[k], NEIGHBOR_DY[k], gs)){
+        continue;
+      }
+      i32 nextI = curI + NEIGHBOR_DY[k] * width + NEIGHBOR_DX[k];
+      f32 newCost = curCost + Weight(curI, nextI, gs);
+      if(newCost < (*dist)[nextI])
+      {
+        (*dist)[nextI] = newCost;
+        frontier.put(nextI, newCost);
+      }
+    }
+  }
+}
+
+// Picks the passable cell furthest from the map center in each of `count`
+// angular sectors, landmarks around the rim of the island give the tightest
+// bounds for paths crossing it
+void PlaceLandmarks(GameState *gs, u32 count)
+{
+  f32 best[MAX_LANDMARKS];
+  i32 cell[MAX_LANDMARKS];
+  for(u32 l = 0; l < count; l++)
+  {
+    best[l] = -1.0f;
+    cell[l] = -1;
+  }
+
+  f32 cx = gs->map_width / 2.0f;
+  f32 cy = gs->map_height / 2.0f;
+  for(u32 y = 0; y < gs->map_height; y++)
+  {
+    for(u32 x = 0; x < gs->map_width; x++)
+    {
+      i32 index = y * gs->map_width + x;
+      if(IsForestedOrWater(index, gs)){
+        continue;
+      }
+      f32 dx = x - cx;
+      f32 dy = y - cy;
+      f32 angle = atan2f(dy, dx) + 3.14159265f;
+      u32 sector = (u32)(angle / (2.0f * 3.14159265f) * count) % count;
+      f32 d = dx * dx + dy * dy;
+      if(d > best[sector])
+      {
+        best[sector] = d;
+        cell[sector] = index;
+  } } }
+
+  gs->num_landmarks = 0;
+  for(u32 l = 0; l < count; l++)
+  {
+    if(cell[l] >= 0){
+      gs->landmarks[gs->num_landmarks++] = cell[l];
+} } }
+
+void BuildLandmarks(GameState *gs)
+{
+  PlaceLandmarks(gs, DEFAULT_LANDMARKS);
+
+  // the landmarks are independent, run their searches side by side
+  u32 count = gs->num_landmarks;
+  vector<vector<f32> > dists(count);
+  vector<thread> workers;
+  for(u32 l = 0; l < count; l++){
+    workers.push_back(thread(LandmarkDijkstra, gs, gs->landmarks[l], &dists[l]));
+  }
+  for(u32 l = 0; l < count; l++){
+    workers[l].join();
+  }
+
+  // interleave by cell so one heuristic lookup touches one cache line
+  u32 cells = gs->map_width * gs->map_height;
+  for(u32 i = 0; i < cells; i++)
+  {
+    for(u32 l = 0; l < count; l++){
+      gs->landmark_dist[i * count + l] = dists[l][i];
+} } }
+
+double LandmarkHeuristic(i32 index, i32 goalI, GameState *gs)
+{
+  u32 count = gs->num_landmarks;
+  f32 *a = gs->landmark_dist + index * count;
+  f32 *b = gs->landmark_dist + goalI * count;
+  double best = 0.0;
+  for(u32 l = 0; l < count; l++)
+  {
+    bool reachA = a[l] != INFINITY;
+    bool reachB = b[l] != INFINITY;
+    if(!reachA && !reachB){
+      continue;
+    }
+    // one of the cells shares the landmark's island and the other doesn't
+    if(reachA != reachB){
+      return INFINITY;
+    }
+    best = max(best, (double)fabs(a[l] - b[l]));
+  }
+  return best;
+}
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdio.h>
+#include <string.h>
+
+#include "typenames.h"
+
+// Fixed size latency histograms, so a long run keeps the same few hundred
+// bytes however many queries it times. The server and the simulation both
+// report with them.
+
+// bucket b counts latencies in [2^b, 2^(b+1)) microseconds, the first also
+// takes everything faster and the last everything slower
+#define LATENCY_BUCKETS 24
+
+struct LatencyHistogram
+{
+  u64 buckets[LATENCY_BUCKETS];
+  u64 count;
+  f64 total_us;
+};
+
+void ClearHistogram(LatencyHistogram *h)
+{
+  memset(h, 0, sizeof(*h));
+}
+
+void AddLatency(LatencyHistogram *h, f64 us)
+{
+  u32 b = 0;
+  while (b + 1 < LATENCY_BUCKETS && us >= (f64)(2u << b)) b++;
+  h->buckets[b] += 1;
+  h->count += 1;
+  h->total_us += us;
+}
+
+void MergeHistogram(LatencyHistogram *into, const LatencyHistogram *h)
+{
+  for (u32 b = 0; b < LATENCY_BUCKETS; b++)
+  {
+    into->buckets[b] += h->buckets[b];
+  }
+  into->count += h->count;
+  into->total_us += h->total_us;
+}
+
+// Upper end of the bucket holding the p-th latency, p in [0, 1]
+f64 HistogramPercentile(const LatencyHistogram *h, f64 p)
+{
+  u64 rank = (u64)(p * (h->count - 1) + 0.5);
+  u64 seen = 0;
+  for (u32 b = 0; b < LATENCY_BUCKETS; b++)
+  {
+    seen += h->buckets[b];
+    if (seen > rank) return (f64)(2u << b);
+  }
+  return (f64)(2u << (LATENCY_BUCKETS - 1));
+}
+
+void PrintHistogram(const char *name, const LatencyHistogram *h)
+{
+  if (h->count == 0)
+  {
+    printf("%s latency: no requests\n", name);
+    return;
+  }
+  printf("%s latency: %llu requests, mean %.1f us, p50 < %.0f us, p99 < %.0f us\n", name,
+    (unsigned long long)h->count, h->total_us / h->count,
+    HistogramPercentile(h, 0.5), HistogramPercentile(h, 0.99));
+  for (u32 b = 0; b < LATENCY_BUCKETS; b++)
+  {
+    if (h->buckets[b] == 0) continue;
+    printf("  < %8u us %10llu\n", 2u << b, (unsigned long long)h->buckets[b]);
+} }
+
+#endif
@@ -0,0 +1,242 @@
+#ifndef LAYER_HASH_H
+#define LAYER_HASH_H
+
+#include <stdio.h>
+#include <string.h>
+
+#include "proc-gen.h"
+
+// Golden hashes of the generated layers for a few seeds and sizes, checked
+// with `./proc-gen --hash-layers`. Generation draws from PCG32 (random.h) and
+// only uses IEEE + - * / and sqrt on floats, so the hashes hold on every
+// platform built without FMA contraction (see the build scripts). A change
+// meant as an optimisation must leave them all alone. A change to the
+// worlds themselves updates the table from the lines the check prints.
+
+// defined in proc-gen.cpp
+bool AllocateWorld(GameState *gs, u32 width, u32 height);
+void GenerateWorld(GameState *gs);
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME  1099511628211ULL
+
+// FNV-1a, continuing from `hash`
+u64 HashBytes(const void *data, size_t size, u64 hash)
+{
+  const u8 *bytes = (const u8 *)data;
+  for (size_t i = 0; i < size; i++)
+  {
+    hash = (hash ^ bytes[i]) * FNV_PRIME;
+  }
+  return hash;
+}
+
+typedef struct LayerHash
+{
+  u32 seed;
+  u32 size;
+  const char *layer;
+  u64 hash;
+} LayerHash;
+
+const u32 HASH_SEEDS[] = {1, 1234, 2021};
+// odd sizes leave partial hydrology tiles and pyramid cells
+const u32 HASH_SIZES[] = {64, 256, 513};
+
+const LayerHash GOLDEN_LAYER_HASHES[] = {
+  {1, 64, "heightmap", 0xf9430a12f66dc474ULL},
+  {1, 64, "slopemap", 0x49a32f43b30182f1ULL},
+  {1, 64, "watermap", 0x5b3458d0338f6734ULL},
+  {1, 64, "forestmap", 0xea617951627a638dULL},
+  {1, 64, "temperaturemap", 0x3f401c9afab13f19ULL},
+  {1, 64, "biomemap", 0x66f7438c15932b8cULL},
+  {1, 64, "flowdir", 0x88b10d54fa815051ULL},
+  {1, 64, "flowmap", 0xcf77372c726b3f48ULL},
+  {1, 64, "rivermap", 0x970070177432d2e3ULL},
+  {1, 64, "pyramid", 0x3d2c8dc7084b5f41ULL},
+  {1234, 64, "heightmap", 0x08937dd0885cb4ccULL},
+  {1234, 64, "slopemap", 0x8bdf01461ff59f47ULL},
+  {1234, 64, "watermap", 0xbe2895c30113be18ULL},
+  {1234, 64, "forestmap", 0x447fc9e7744dbb2fULL},
+  {1234, 64, "temperaturemap", 0xbe736dde0dd25178ULL},
+  {1234, 64, "biomemap", 0x864d7f4caee51b83ULL},
+  {1234, 64, "flowdir", 0x4ffd21e8748842e7ULL},
+  {1234, 64, "flowmap", 0x8dca5938774bfc6dULL},
+  {1234, 64, "rivermap", 0x6202d139de7b97caULL},
+  {1234, 64, "pyramid", 0xce411680558c2e56ULL},
+  {2021, 64, "heightmap", 0x8da6f42fc37df35cULL},
+  {2021, 64, "slopemap", 0xa6ad32211454af18ULL},
+  {2021, 64, "watermap", 0x22ed71f7f17af5f6ULL},
+  {2021, 64, "forestmap", 0x7ceead0c6b65d20fULL},
+  {2021, 64, "temperaturemap", 0x5546e34f281fd3f1ULL},
+  {2021, 64, "biomemap", 0x88ef90a2a16e53bfULL},
+  {2021, 64, "flowdir", 0x1b5d78dc456ce76dULL},
+  {2021, 64, "flowmap", 0xe70a3aefa22f438cULL},
+  {2021, 64, "rivermap", 0x8ed29dc9042f5471ULL},
+  {2021, 64, "pyramid", 0x0b5f7bc33b3a1a8aULL},
+  {1, 256, "heightmap", 0x893b6df0a89d2a40ULL},
+  {1, 256, "slopemap", 0xfd95819fbae1a209ULL},
+  {1, 256, "watermap", 0x7e95084079140cadULL},
+  {1, 256, "forestmap", 0x345e3917f248a142ULL},
+  {1, 256, "temperaturemap", 0xe599050759d8e40cULL},
+  {1, 256, "biomemap", 0x97ec919f8f3be489ULL},
+  {1, 256, "flowdir", 0x46cb0b35d4cd5575ULL},
+  {1, 256, "flowmap", 0xc05b62b809a66169ULL},
+  {1, 256, "rivermap", 0x3be798527e075c66ULL},
+  {1, 256, "pyramid", 0x27f088bc1f32f500ULL},
+  {1234, 256, "heightmap", 0xf48b1058005a1f13ULL},
+  {1234, 256, "slopemap", 0x114f3f2cb7e2048eULL},
+  {1234, 256, "watermap", 0x667ec47691036dc7ULL},
+  {1234, 256, "forestmap", 0xfd3aee377f29d93eULL},
+  {1234, 256, "temperaturemap", 0x3c2fcb507206b39bULL},
+  {1234, 256, "biomemap", 0xcf7b78ffcc1791efULL},
+  {1234, 256, "flowdir", 0xca236d94c65110a1ULL},
+  {1234, 256, "flowmap", 0xd2d1698357f83898ULL},
+  {1234, 256, "rivermap", 0x70718dc4238ba1c5ULL},
+  {1234, 256, "pyramid", 0x028fa291792a7c86ULL},
+  {2021, 256, "heightmap", 0x65bdaa77a17eb472ULL},
+  {2021, 256, "slopemap", 0xbe67ae4b7b7d816eULL},
+  {2021, 256, "watermap", 0xb8316338fca2956bULL},
+  {2021, 256, "forestmap", 0x9328290c5ec5a99dULL},
+  {2021, 256, "temperaturemap", 0x608c0124b7e62cfbULL},
+  {2021, 256, "biomemap", 0x9402552e054845a2ULL},
+  {2021, 256, "flowdir", 0xbe73970939387e33ULL},
+  {2021, 256, "flowmap", 0x6abe49e219cd6302ULL},
+  {2021, 256, "rivermap", 0xd170ba7c41d5b9d7ULL},
+  {2021, 256, "pyramid", 0x41f297c1a3bb886bULL},
+  {1, 513, "heightmap", 0xb6e998a88a53dfa4ULL},
+  {1, 513, "slopemap", 0x5f18c46dde76b029ULL},
+  {1, 513, "watermap", 0xf380f317d15611eaULL},
+  {1, 513, "forestmap", 0x09e662d370d21d5fULL},
+  {1, 513, "temperaturemap", 0x30d4a26cfa6a1836ULL},
+  {1, 513, "biomemap", 0x353b9667f017887fULL},
+  {1, 513, "flowdir", 0x0521959821738b93ULL},
+  {1, 513, "flowmap", 0xffdb953329e2eb78ULL},
+  {1, 513, "rivermap", 0x6832c396fde02848ULL},
+  {1, 513, "pyramid", 0x928a55c5fc2d1039ULL},
+  {1234, 513, "heightmap", 0x486d06083755bc42ULL},
+  {1234, 513, "slopemap", 0xdcbc29c3b30460c5ULL},
+  {1234, 513, "watermap", 0x36c9d08e6c0312fcULL},
+  {1234, 513, "forestmap", 0x12cee8805c03ba96ULL},
+  {1234, 513, "temperaturemap", 0xde9836f99f4a60aeULL},
+  {1234, 513, "biomemap", 0x34844fc5a66f044bULL},
+  {1234, 513, "flowdir", 0x3dd7ea9533004f3eULL},
+  {1234, 513, "flowmap", 0x10151a5b68c76b98ULL},
+  {1234, 513, "rivermap", 0xbeee33d9a9076091ULL},
+  {1234, 513, "pyramid", 0x5f2c189adce6b8b8ULL},
+  {2021, 513, "heightmap", 0xa5e6b915c75b123eULL},
+  {2021, 513, "slopemap", 0xb0acfb59fa01c190ULL},
+  {2021, 513, "watermap", 0x450d66e2c3a2beeaULL},
+  {2021, 513, "forestmap", 0x2105dd4eec0e9dd0ULL},
+  {2021, 513, "temperaturemap", 0xb40bd89e24891114ULL},
+  {2021, 513, "biomemap", 0xc2a95e1d663fd168ULL},
+  {2021, 513, "flowdir", 0x3165156d37bcf9edULL},
+  {2021, 513, "flowmap", 0xb44b685f736ff516ULL},
+  {2021, 513, "rivermap", 0xd5872d69b8750290ULL},
+  {2021, 513, "pyramid", 0x0b42e237498ed08aULL},
+};
+
+#define MAX_HASHED_LAYERS 16
+
+// Hashes each generated layer of the current world into hashes[], named in
+// names[]. Returns the number of layers. The pyramid counts as one layer.
+u32 HashLayers(GameState *gs, const char **names, u64 *hashes)
+{
+  size_t cells = (size_t)gs->map_width * gs->map_height;
+  u32 n = 0;
+  names[n] = "heightmap";      hashes[n++] = HashBytes(gs->heightmap, cells * sizeof(f32), FNV_OFFSET);
+  names[n] = "slopemap";       hashes[n++] = HashBytes(gs->slopemap, cells * sizeof(u32), FNV_OFFSET);
+  names[n] = "watermap";       hashes[n++] = HashBytes(gs->watermap, cells, FNV_OFFSET);
+  names[n] = "forestmap";      hashes[n++] = HashBytes(gs->forestmap, cells, FNV_OFFSET);
+  names[n] = "temperaturemap"; hashes[n++] = HashBytes(gs->temperaturemap, cells, FNV_OFFSET);
+  names[n] = "biomemap";       hashes[n++] = HashBytes(gs->biomemap, cells, FNV_OFFSET);
+  names[n] = "flowdir";        hashes[n++] = HashBytes(gs->flowdir, cells, FNV_OFFSET);
+  names[n] = "flowmap";        hashes[n++] = HashBytes(gs->flowmap, cells * sizeof(f32), FNV_OFFSET);
+  names[n] = "rivermap";       hashes[n++] = HashBytes(gs->rivermap, cells, FNV_OFFSET);
+
+  u64 pyramid = FNV_OFFSET;
+  for (u32 l = 1; l <= gs->pyramid_levels; l++)
+  {
+    PyramidLevel *p = &gs->pyramid[l];
+    size_t c = (size_t)p->width * p->height;
+    pyramid = HashBytes(p->height_min, c * sizeof(f32), pyramid);
+    pyramid = HashBytes(p->height_max, c * sizeof(f32), pyramid);
+    pyramid = HashBytes(p->height_avg, c * sizeof(f32), pyramid);
+    pyramid = HashBytes(p->slope_max, c * sizeof(u32), pyramid);
+    pyramid = HashBytes(p->slope_avg, c * sizeof(u32), pyramid);
+    pyramid = HashBytes(p->water_min, c, pyramid);
+    pyramid = HashBytes(p->water_max, c, pyramid);
+    pyramid = HashBytes(p->water_avg, c, pyramid);
+    pyramid = HashBytes(p->forest_avg, c, pyramid);
+    pyramid = HashBytes(p->river_max, c, pyramid);
+    pyramid = HashBytes(p->biome, c, pyramid);
+    pyramid = HashBytes(p->passable, c, pyramid);
+  }
+  names[n] = "pyramid";        hashes[n++] = pyramid;
+  return n;
+}
+
+const LayerHash *FindGoldenHash(u32 seed, u32 size, const char *layer)
+{
+  for (u32 i = 0; i < sizeof(GOLDEN_LAYER_HASHES) / sizeof(GOLDEN_LAYER_HASHES[0]); i++)
+  {
+    const LayerHash *g = &GOLDEN_LAYER_HASHES[i];
+    if (g->seed == seed && g->size == size && strcmp(g->layer, layer) == 0) return g;
+  }
+  return NULL;
+}
+
+// Generates every seed and size of the matrix and compares its layers with
+// the golden hashes. Returns the number of layers that differ or have none.
+u32 RunLayerHashes(GameState *gs)
+{
+  const u32 seeds = sizeof(HASH_SEEDS) / sizeof(HASH_SEEDS[0]);
+  const u32 sizes = sizeof(HASH_SIZES) / sizeof(HASH_SIZES[0]);
+  LayerHash found[seeds * sizes * MAX_HASHED_LAYERS];
+  u32 count = 0;
+  u32 failed = 0;
+
+  printf("%10s %6s %-16s %-18s %s\n", "seed", "size", "layer", "hash", "golden");
+  for (u32 z = 0; z < sizes; z++)
+  {
+    for (u32 s = 0; s < seeds; s++)
+    {
+      if (!AllocateWorld(gs, HASH_SIZES[z], HASH_SIZES[z]))
+      {
+        printf("Not enough memory for a %ux%u world\n", HASH_SIZES[z], HASH_SIZES[z]);
+        return seeds * sizes * MAX_HASHED_LAYERS;
+      }
+      gs->seed = HASH_SEEDS[s];
+      GenerateWorld(gs);
+
+      const char *names[MAX_HASHED_LAYERS];
+      u64 hashes[MAX_HASHED_LAYERS];
+      u32 layers = HashLayers(gs, names, hashes);
+      for (u32 l = 0; l < layers; l++)
+      {
+        const LayerHash *golden = FindGoldenHash(HASH_SEEDS[s], HASH_SIZES[z], names[l]);
+        const char *status = !golden ? "missing" : (golden->hash == hashes[l]) ? "ok" : "DIFFERS";
+        failed += (!golden || golden->hash != hashes[l]);
+        printf("%10u %6u %-16s %016llx %s\n", HASH_SEEDS[s], HASH_SIZES[z], names[l],
+          (unsigned long long)hashes[l], status);
+        LayerHash h = {HASH_SEEDS[s], HASH_SIZES[z], names[l], hashes[l]};
+        found[count++] = h;
+  } } }
+
+  if (failed)
+  {
+    printf("\n%u layers differ from GOLDEN_LAYER_HASHES, if the worlds are meant to change it becomes:\n", failed);
+    for (u32 i = 0; i < count; i++)
+    {
+      printf("  {%u, %u, \"%s\", 0x%016llxULL},\n", found[i].seed, found[i].size, found[i].layer,
+        (unsigned long long)found[i].hash);
+    }
+  }
+  else
+  {
+    printf("\nAll %u layers match\n", count);
+  }
+  return failed;
+}
+
+#endif
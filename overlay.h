@@ -0,0 +1,157 @@
+#ifndef OVERLAY_H
+#define OVERLAY_H
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#include "proc-gen.h"
+
+// What the window draws over the map, kept in textures so a frame costs the
+// same however long the path or the help text. The path's waypoints are
+// drawn into a map sized texture when the path or the agent's waypoint
+// changes, the help and legend into a panel when the mapmode does. Lines of
+// HUD text that change are only formatted again when what they show does.
+
+using namespace std;
+
+// Overlay of the agent's path, one pixel per map cell
+typedef struct PathOverlay
+{
+  RenderTexture2D target;
+  u32 path_version; // path drawn, see PlanAgentPath()
+  u32 waypoint;     // first waypoint drawn
+  bool drawn;       // anything is on the texture
+} PathOverlay;
+
+void LoadPathOverlay(PathOverlay *overlay, u32 width, u32 height)
+{
+  overlay->target = LoadRenderTexture(width, height);
+  overlay->path_version = 0;
+  overlay->waypoint = 0;
+  overlay->drawn = true; // cleared on the first update
+}
+
+// Redraws the path from the agent's next waypoint on, if that changed. The
+// segment the agent is on moves every frame, DrawPath() draws it itself.
+void UpdatePathOverlay(PathOverlay *overlay, GameState *gs)
+{
+  bool shown = gs->new_target_set && gs->path_waypoint < gs->waypoints.size();
+  if (!shown && !overlay->drawn) return;
+  if (shown && overlay->drawn && overlay->path_version == gs->path_version
+    && overlay->waypoint == gs->path_waypoint) return;
+
+  BeginTextureMode(overlay->target);
+  ClearBackground(BLANK);
+  if (shown)
+  {
+    for (u32 w = gs->path_waypoint + 1; w < gs->waypoints.size(); w++)
+    {
+      i32 a = gs->waypoints[w - 1];
+      i32 b = gs->waypoints[w];
+      DrawLineEx(/*(Vector2)*/{a % gs->map_width + 0.5f, a / gs->map_width + 0.5f},
+        /*(Vector2)*/{b % gs->map_width + 0.5f, b / gs->map_width + 0.5f}, 1.0f, ORANGE);
+  } }
+  EndTextureMode();
+  overlay->path_version = gs->path_version;
+  overlay->waypoint = gs->path_waypoint;
+  overlay->drawn = shown;
+}
+
+// The overlay plus the agent's current segment, at `scale` pixels per cell
+void DrawPath(PathOverlay *overlay, GameState *gs, Vector2 origin, f32 scale)
+{
+  if (!overlay->drawn) return;
+  // render textures come out upside down
+  Rectangle source = {0, 0, (f32)overlay->target.texture.width, -(f32)overlay->target.texture.height};
+  Rectangle dest = {origin.x, origin.y, gs->map_width * scale, gs->map_height * scale};
+  DrawTexturePro(overlay->target.texture, source, dest, /*(Vector2)*/{0, 0}, 0, WHITE);
+
+  i32 next = gs->waypoints[gs->path_waypoint];
+  Vector2 half = /*(Vector2)*/{0.5f * scale, 0.5f * scale};
+  Vector2 from = Vector2Add(Vector2Add(origin, Vector2Scale(gs->player_pos, scale)), half);
+  Vector2 to = Vector2Add(Vector2Add(origin, Vector2Scale(/*(Vector2)*/{(f32)(next % gs->map_width),
+    (f32)(next / gs->map_width)}, scale)), half);
+  DrawLineEx(from, to, scale, ORANGE);
+}
+
+// HUD ---------------------------------------------------------------------------
+
+#define HUD_FONT_SIZE 24
+#define HUD_LINE_HEIGHT 24
+
+const char *HUD_HELP =
+  "Mapmodes and other buttons:\nLeftClick: pathfind to clicked grid cell\n"
+  "RightClick: move agent to clicked grid cell\nA: Heightmap\nS: Slopemap\nD: Watermap\n"
+  "F: Forestmap\nG: Fancymap\n1-5: 4-dir, 8-dir, Theta*, Lazy Theta*, flow field search\n"
+  "L: toggle landmark heuristic\nB: toggle bidirectional search\n"
+  "M: cycle height, slope, moisture, biome costs\nC: toggle path cache\n"
+  "E / Q: plant / clear forest at cursor\nWheel: zoom";
+
+// by mapmode, SIMPLESLOPEMAP has none
+const char *HUD_LEGENDS[THEGOODONE + 1] = {
+  "Heightmap: Black = Low Elevation, White = High Elevation, Blue = Water",
+  "Slopemap: Darker Color = Higher Elevation, Lighter Color = Lower Elevation\n"
+    "Purple->Green->Yellow->Red : Slope increases left to right",
+  "",
+  "Watermap: Darker BLUE = More Rain, rivers in the darkest blue",
+  "ForestMap: Light Green = No forest, Dark Green = forest",
+  "Fancymap: Biomes, from elevation, slope, moisture and temperature"
+};
+
+// y of the legend in the panel, where it sat under the help before
+#define HUD_LEGEND_Y 400
+
+// The help and the mapmode's legend, drawn once per mapmode
+typedef struct HudPanel
+{
+  RenderTexture2D target;
+  u32 mapmode; // legend drawn, ~0 for none yet
+} HudPanel;
+
+void LoadHudPanel(HudPanel *panel)
+{
+  i32 width = MeasureText(HUD_HELP, HUD_FONT_SIZE);
+  for (u32 m = 0; m <= THEGOODONE; m++)
+  {
+    width = max(width, MeasureText(HUD_LEGENDS[m], HUD_FONT_SIZE));
+  }
+  panel->target = LoadRenderTexture(width, HUD_LEGEND_Y + 4 * HUD_LINE_HEIGHT);
+  panel->mapmode = ~0u;
+}
+
+void DrawHudPanel(HudPanel *panel, u32 mapmode, Vector2 position)
+{
+  if (panel->mapmode != mapmode)
+  {
+    BeginTextureMode(panel->target);
+    ClearBackground(BLANK);
+    DrawText(HUD_HELP, 0, 0, HUD_FONT_SIZE, BLACK);
+    DrawText("Legend:", 0, HUD_LEGEND_Y, HUD_FONT_SIZE, YELLOW);
+    DrawText(HUD_LEGENDS[mapmode], 0, HUD_LEGEND_Y + HUD_LINE_HEIGHT, HUD_FONT_SIZE, YELLOW);
+    EndTextureMode();
+    panel->mapmode = mapmode;
+  }
+  Rectangle source = {0, 0, (f32)panel->target.texture.width, -(f32)panel->target.texture.height};
+  DrawTextureRec(panel->target.texture, source, position, WHITE);
+}
+
+// A line of HUD text and the values it was formatted from
+typedef struct HudLine
+{
+  u64 values[4];
+  bool formatted;
+  char text[256];
+} HudLine;
+
+// True when the line has to be formatted again to show these values
+bool HudLineStale(HudLine *line, u64 a, u64 b, u64 c, u64 d)
+{
+  u64 values[4] = {a, b, c, d};
+  if (line->formatted && memcmp(values, line->values, sizeof(values)) == 0) return false;
+  memcpy(line->values, values, sizeof(values));
+  line->formatted = true;
+  return true;
+}
+
+#endif
@@ -0,0 +1,297 @@
+#ifndef PATH_CACHE_H
+#define PATH_CACHE_H
+
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+
+#include "proc-gen.h"
+#include "grid.h"
+#include "grid-search.h"
+
+// Bounded cache of finished path queries. Entries are keyed on the start and
+// goal cell plus the search settings, and only live as long as the map
+// version they were searched on. Parts of an optimal path are optimal too, so
+// when the search is exact (see OptimalSearch) a query that starts on a cached
+// path to the same goal takes its tail, and one that ends on a cached path
+// from the same start takes its head. Other searches only get exact hits, so
+// a cached answer always costs what a fresh search would.
+
+#define PATH_CACHE_SIZE 256
+
+using namespace std;
+
+struct PathKey
+{
+  i32 start;
+  i32 goal;
+  u32 settings; // search mode and flags, see SearchSettings
+
+  bool operator==(const PathKey &other) const
+  {
+    return start == other.start && goal == other.goal && settings == other.settings;
+  }
+};
+
+struct PathKeyHash
+{
+  size_t operator()(const PathKey &key) const
+  {
+    u64 h = ((u64)(u32)key.start << 32) ^ (u32)key.goal ^ ((u64)key.settings << 56);
+    return (size_t)(h * 0x9E3779B97F4A7C15ull);
+  }
+};
+
+struct CachedPath
+{
+  PathKey key;
+  vector<i32> cells;    // empty when the goal can't be reached
+  vector<f64> cost_to;  // cost from cells[i] to the goal, under the key's cost model
+  f64 cost;             // what the search reported, returned on exact hits
+};
+
+typedef list<CachedPath>::iterator CachedPathIt;
+
+// Least recently used entries first in `order`
+struct PathCache
+{
+  mutex lock;
+  u32 capacity;
+  u32 version; // map version of every entry
+  list<CachedPath> order;
+  unordered_map<PathKey, CachedPathIt, PathKeyHash> exact;
+  unordered_multimap<i32, CachedPathIt> by_goal;
+  unordered_multimap<i32, CachedPathIt> by_start;
+
+  u64 hits;
+  u64 subpath_hits;
+  u64 misses;
+};
+
+PathCache *CreatePathCache(u32 capacity)
+{
+  PathCache *cache = new PathCache();
+  cache->capacity = capacity;
+  cache->version = 0;
+  cache->hits = 0;
+  cache->subpath_hits = 0;
+  cache->misses = 0;
+  return cache;
+}
+
+u32 SearchSettings(GameState *gs)
+{
+  return gs->search_mode | (gs->use_landmarks << 4) | (gs->bidirectional << 5) | (gs->cost_model << 6);
+}
+
+// True when the settings find least cost paths: grid moves on the height
+// cost, guided by the landmark bound. Weight() makes distance free, so the
+// grid distance heuristics overestimate it, and Theta*'s any-angle paths
+// aren't optimal either.
+bool OptimalSearch(GameState *gs)
+{
+  bool grid = (gs->search_mode == SEARCH_4DIR || gs->search_mode == SEARCH_8DIR);
+  return grid && gs->cost_model == COST_HEIGHT && gs->use_landmarks && gs->num_landmarks > 0;
+}
+
+void EraseIndexed(unordered_multimap<i32, CachedPathIt> &index, i32 cell, CachedPathIt entry)
+{
+  pair<unordered_multimap<i32, CachedPathIt>::iterator, unordered_multimap<i32, CachedPathIt>::iterator> range = index.equal_range(cell);
+  for(unordered_multimap<i32, CachedPathIt>::iterator it = range.first; it != range.second; ++it)
+  {
+    if(it->second == entry)
+    {
+      index.erase(it);
+      return;
+} } }
+
+// Entries from an older map are useless, drop them all at once. Views only
+// pick up a new map version at ShareWorld(), so one may still be behind the
+// cache; the version only moves forward and false means the caller's map is
+// older than the entries. Call with the lock held.
+bool SyncPathCacheVersion(PathCache *cache, u32 version)
+{
+  if(version < cache->version){
+    return false;
+  }
+  if(version > cache->version)
+  {
+    cache->order.clear();
+    cache->exact.clear();
+    cache->by_goal.clear();
+    cache->by_start.clear();
+    cache->version = version;
+  }
+  return true;
+}
+
+// Fills gs->path and gs->path_cost from the cache, false on a miss
+bool LookupPath(PathCache *cache, GameState *gs)
+{
+  PathKey key;
+  key.start = Index(gs->player_pos, gs->map_width);
+  key.goal = Index(gs->target_pos, gs->map_width);
+  key.settings = SearchSettings(gs);
+
+  lock_guard<mutex> guard(cache->lock);
+  if(!SyncPathCacheVersion(cache, gs->map_version))
+  {
+    cache->misses += 1;
+    return false;
+  }
+
+  const CachedPath *hit = NULL;
+  u32 first = 0;
+  u32 last = 0;
+  unordered_map<PathKey, CachedPathIt, PathKeyHash>::iterator found = cache->exact.find(key);
+  if(found != cache->exact.end())
+  {
+    cache->order.splice(cache->order.end(), cache->order, found->second);
+    hit = &*found->second;
+    last = hit->cells.size();
+    cache->hits += 1;
+  }
+  else if(OptimalSearch(gs))
+  {
+    // tail of a path to the same goal
+    pair<unordered_multimap<i32, CachedPathIt>::iterator, unordered_multimap<i32, CachedPathIt>::iterator> range = cache->by_goal.equal_range(key.goal);
+    for(unordered_multimap<i32, CachedPathIt>::iterator it = range.first; it != range.second && !hit; ++it)
+    {
+      const CachedPath &entry = *it->second;
+      if(entry.key.settings != key.settings){
+        continue;
+      }
+      for(u32 i = 0; i < entry.cells.size(); i++)
+      {
+        if(entry.cells[i] == key.start)
+        {
+          hit = &entry;
+          first = i;
+          last = entry.cells.size();
+          break;
+    } } }
+    // head of a path from the same start
+    range = cache->by_start.equal_range(key.start);
+    for(unordered_multimap<i32, CachedPathIt>::iterator it = range.first; it != range.second && !hit; ++it)
+    {
+      const CachedPath &entry = *it->second;
+      if(entry.key.settings != key.settings){
+        continue;
+      }
+      for(u32 i = 0; i < entry.cells.size(); i++)
+      {
+        if(entry.cells[i] == key.goal)
+        {
+          hit = &entry;
+          first = 0;
+          last = i + 1;
+          break;
+    } } }
+    if(!hit)
+    {
+      cache->misses += 1;
+      return false;
+    }
+    cache->subpath_hits += 1;
+  }
+  else
+  {
+    cache->misses += 1;
+    return false;
+  }
+
+  delete gs->path;
+  gs->path = new list<int>(hit->cells.begin() + first, hit->cells.begin() + last);
+  gs->search_expansions = 0;
+  if(hit->cells.empty()) gs->path_cost = INFINITY;
+  else if(first == 0 && last == hit->cells.size()) gs->path_cost = hit->cost;
+  else gs->path_cost = hit->cost_to[first] - hit->cost_to[last - 1];
+  return true;
+}
+
+// Fills cost_to[i] with the cost from cells[i] to the last cell. Grid paths
+// step between neighbors, any-angle ones (height cost only) cost each
+// segment along its line.
+template<typename Cost>
+void CostToGoal(Cost cost, const vector<i32> &cells, vector<f64> *cost_to, GameState *gs)
+{
+  i32 width = gs->map_width;
+  cost_to->resize(cells.size());
+  f64 total = 0.0;
+  for(i32 i = (i32)cells.size() - 1; i >= 0; i--)
+  {
+    (*cost_to)[i] = total;
+    if(i == 0){
+      break;
+    }
+    i32 dx = abs(cells[i] % width - cells[i - 1] % width);
+    i32 dy = abs(cells[i] / width - cells[i - 1] / width);
+    if(dx > 1 || dy > 1)
+    {
+      double segment = 0.0;
+      LineOfSight(cells[i - 1], cells[i], gs, &segment);
+      total += segment;
+    }
+    else
+    {
+      total += cost.Step(cells[i - 1], cells[i], (dx && dy) ? 1.41421356237 : 1.0);
+} } }
+
+// Remembers the query just answered in gs->path
+void StorePath(PathCache *cache, GameState *gs)
+{
+  CachedPath entry;
+  entry.key.start = Index(gs->player_pos, gs->map_width);
+  entry.key.goal = Index(gs->target_pos, gs->map_width);
+  entry.key.settings = SearchSettings(gs);
+  entry.cells.assign(gs->path->begin(), gs->path->end());
+  entry.cost = gs->path_cost;
+  if(gs->cost_model == COST_SLOPE)
+  {
+    SlopeCost cost = {gs};
+    CostToGoal(cost, entry.cells, &entry.cost_to, gs);
+  }
+  else if(gs->cost_model == COST_MOISTURE)
+  {
+    MoistureCost cost = {gs};
+    CostToGoal(cost, entry.cells, &entry.cost_to, gs);
+  }
+  else if(gs->cost_model == COST_BIOME)
+  {
+    BiomeCost cost = {gs};
+    CostToGoal(cost, entry.cells, &entry.cost_to, gs);
+  }
+  else
+  {
+    HeightCost cost = {gs};
+    CostToGoal(cost, entry.cells, &entry.cost_to, gs);
+  }
+
+  lock_guard<mutex> guard(cache->lock);
+  // a newer map has been cached since the search started, the answer is stale
+  if(!SyncPathCacheVersion(cache, gs->map_version)){
+    return;
+  }
+  if(cache->exact.count(entry.key)){
+    return;
+  }
+  if(cache->order.size() >= cache->capacity)
+  {
+    CachedPathIt oldest = cache->order.begin();
+    cache->exact.erase(oldest->key);
+    EraseIndexed(cache->by_goal, oldest->key.goal, oldest);
+    EraseIndexed(cache->by_start, oldest->key.start, oldest);
+    cache->order.pop_front();
+  }
+  cache->order.push_back(entry);
+  CachedPathIt added = --cache->order.end();
+  cache->exact[entry.key] = added;
+  if(!entry.cells.empty())
+  {
+    cache->by_goal.insert(make_pair(entry.key.goal, added));
+    cache->by_start.insert(make_pair(entry.key.start, added));
+  }
+}
+
+#endif
@@ -0,0 +1,160 @@
+#ifndef PATH_SMOOTH_H
+#define PATH_SMOOTH_H
+
+#include <vector>
+#include <list>
+#include <math.h>
+
+#include "proc-gen.h"
+#include "grid.h"
+#include "grid-search.h"
+
+// Turns a path of cells into waypoints. A grid path spends most of its cells
+// on straight runs, so only the cells where the step changes are kept, then
+// any waypoint that the previous one can see over the passability grid is
+// dropped as long as the straight line costs no more than the stretch of path
+// it replaces. Consecutive waypoints are always joined by the LineCell()
+// line, which is what the agent walks and what gets drawn.
+
+using namespace std;
+
+// Walks the LineCell() line between two cells, false on the first step the
+// cost's passability (with CanStep()'s corner rule) doesn't allow
+template<typename Cost>
+bool LineCost(const Cost &cost, i32 fromI, i32 toI, i32 width, f64 *out)
+{
+  i32 ax = fromI % width, ay = fromI / width;
+  i32 bx = toI % width, by = toI / width;
+  i32 n = max(abs(bx - ax), abs(by - ay));
+
+  f64 total = 0.0;
+  i32 prevI = fromI;
+  i32 prevX = ax, prevY = ay;
+  for(i32 step = 1; step <= n; step++)
+  {
+    i32 cellI = LineCell(ax, ay, bx, by, step, width);
+    i32 cellX = cellI % width, cellY = cellI / width;
+    if(!cost.Passable(cellI)){
+      return false;
+    }
+    if(cellX != prevX && cellY != prevY &&
+      (!cost.Passable(prevY * width + cellX) || !cost.Passable(cellY * width + prevX))){
+      return false;
+    }
+    f64 length = (cellX != prevX && cellY != prevY) ? 1.41421356237 : 1.0;
+    total += cost.Step(prevI, cellI, length);
+    prevI = cellI;
+    prevX = cellX;
+    prevY = cellY;
+  }
+  *out = total;
+  return true;
+}
+
+// Fills `waypoints` from `cells`, costs are the cost's Step()
+template<typename Cost>
+void SmoothCells(const Cost &cost, const list<int> &cells, i32 width, vector<i32> *waypoints)
+{
+  waypoints->clear();
+  if(cells.empty()){
+    return;
+  }
+
+  // the ends and every cell the step changes at, with the path cost to each
+  static thread_local vector<i32> turns;
+  static thread_local vector<f64> costTo;
+  turns.clear();
+  costTo.clear();
+  list<int>::const_iterator it = cells.begin();
+  i32 prev = *it;
+  i32 prevStep = 0;
+  f64 total = 0.0;
+  turns.push_back(prev);
+  costTo.push_back(0.0);
+  for(++it; it != cells.end(); ++it)
+  {
+    i32 dx = *it % width - prev % width;
+    i32 dy = *it / width - prev / width;
+    // only unit steps make runs, any-angle paths are waypoints already
+    bool unit = abs(dx) <= 1 && abs(dy) <= 1;
+    i32 step = *it - prev;
+    if(!unit || step != prevStep){
+      if(turns.back() != prev)
+      {
+        turns.push_back(prev);
+        costTo.push_back(total);
+      }
+    }
+    f64 segment;
+    if(unit){
+      total += cost.Step(prev, *it, (dx != 0 && dy != 0) ? 1.41421356237 : 1.0);
+    }
+    else if(LineCost(cost, prev, *it, width, &segment)){
+      total += segment;
+    }
+    else{
+      total = INFINITY; // not walkable as a line, never shortcut past it
+    }
+    prevStep = unit ? step : 0;
+    prev = *it;
+  }
+  if(turns.back() != prev)
+  {
+    turns.push_back(prev);
+    costTo.push_back(total);
+  }
+
+  // from each waypoint, skip to the furthest turn it can see for no more
+  // than the path's cost. The next turn is always reachable: it's the end of
+  // a straight run, or an any-angle waypoint.
+  waypoints->push_back(turns[0]);
+  u32 last = turns.size() - 1;
+  for(u32 anchor = 0; anchor < last; )
+  {
+    u32 best = anchor + 1;
+    for(u32 j = anchor + 2; j <= last; j++)
+    {
+      f64 lineCost;
+      f64 pathCost = costTo[j] - costTo[anchor];
+      // written so an infinite path cost (NaN here) never takes a shortcut
+      if(!LineCost(cost, turns[anchor], turns[j], width, &lineCost) ||
+        !(lineCost <= pathCost + 1e-9 * (1.0 + pathCost))){
+        break;
+      }
+      best = j;
+    }
+    waypoints->push_back(turns[best]);
+    anchor = best;
+  }
+}
+
+// Smooths gs->path into gs->waypoints under gs->cost_model
+void SmoothPath(GameState *gs)
+{
+  i32 width = gs->map_width;
+  if(gs->cost_model == COST_SLOPE)
+  {
+    SlopeCost cost = {gs};
+    SmoothCells(cost, *gs->path, width, &gs->waypoints);
+  }
+  else if(gs->cost_model == COST_MOISTURE)
+  {
+    MoistureCost cost = {gs};
+    SmoothCells(cost, *gs->path, width, &gs->waypoints);
+  }
+  else if(gs->cost_model == COST_BIOME)
+  {
+    BiomeCost cost = {gs};
+    SmoothCells(cost, *gs->path, width, &gs->waypoints);
+  }
+  else
+  {
+    HeightCost cost = {gs};
+    SmoothCells(cost, *gs->path, width, &gs->waypoints);
+  }
+  if(gs->search_log){
+    printf("Waypoints: %d for %d path nodes\n", (i32)gs->waypoints.size(), (i32)gs->path->size());
+  }
+}
+
+#endif
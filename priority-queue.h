@@ -16,6 +16,7 @@ struct PriorityQueue{
 
   inline bool empty() const { return elements.empty(); }
   inline void put(T item, priority_t priority){ elements.emplace(priority, item); }
+  inline priority_t top_priority() const { return elements.top().first; }
   T get() {
     T top = elements.top().second;
     elements.pop();
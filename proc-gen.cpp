@@ -4,6 +4,7 @@
 #include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "raymath.h"
 
 #include <vector>
@@ -11,24 +12,80 @@
 
 #include "proc-gen.h"
 #include "simplex.h"
+#include "random.h"
 #include "priority-queue.h"
 #include "astar.h"
+#include "landmarks.h"
+#include "flowfield.h"
+#include "pyramid.h"
+#include "hydrology.h"
+#include "biome.h"
+#include "benchmark.h"
+#include "path-smooth.h"
+#include "overlay.h"
+#include "layer-hash.h"
+#include "export.h"
+#include "server.h"
+#include "simulation.h"
 
 // Map Functions ---------------------------------------------------------------
-u32 ValidNeighbor(i32 neighbor, u32 width, u32 height)
+// Lays the layers of a width x height world out in the state's arena. A world
+// of the same (or smaller) size reuses the block, so regenerating doesn't
+// allocate.
+bool AllocateWorld(GameState *gs, u32 width, u32 height)
 {
-  if (neighbor < 0) return false;
-  if (neighbor >= (i32)(width * height)) return false;
-
-  i32 x = neighbor % (i32)width;
-  i32 y = neighbor / (i32)width;
-
-  if (x < 0 || x == (i32)width)
-    return false;
-  else if (y < 0 || y == (i32)height)
-    return false;
-  else
-    return true;
+  size_t cells = (size_t)width * height;
+  size_t heightmap = 0;
+  size_t slopemap = heightmap + AlignUp(cells * sizeof(f32), ARENA_ALIGN);
+  size_t watermap = slopemap + AlignUp(cells * sizeof(u32), ARENA_ALIGN);
+  size_t forestmap = watermap + AlignUp(cells * sizeof(u8), ARENA_ALIGN);
+  size_t temperaturemap = forestmap + AlignUp(cells * sizeof(u8), ARENA_ALIGN);
+  size_t biomemap = temperaturemap + AlignUp(cells * sizeof(u8), ARENA_ALIGN);
+  size_t flowdir = biomemap + AlignUp(cells * sizeof(u8), ARENA_ALIGN);
+  size_t flowmap = flowdir + AlignUp(cells * sizeof(u8), ARENA_ALIGN);
+  size_t rivermap = flowmap + AlignUp(cells * sizeof(f32), ARENA_ALIGN);
+  size_t erosion_scratch = rivermap + AlignUp(cells * sizeof(u8), ARENA_ALIGN);
+  size_t map_data = erosion_scratch + AlignUp(cells * sizeof(f32), ARENA_ALIGN);
+  size_t landmark_dist = map_data + AlignUp(cells * sizeof(Color), ARENA_ALIGN);
+  size_t pyramid = landmark_dist + AlignUp(cells * DEFAULT_LANDMARKS * sizeof(f32), ARENA_ALIGN);
+
+  gs->map_width = width;
+  gs->map_height = height;
+  size_t total = LayOutPyramid(gs, NULL, pyramid);
+
+  u8 *base = gs->arena.Reserve(total);
+  if (!base) return false;
+
+  gs->heightmap = (f32 *)(base + heightmap);
+  gs->slopemap = (u32 *)(base + slopemap);
+  gs->watermap = (u8 *)(base + watermap);
+  gs->forestmap = (u8 *)(base + forestmap);
+  gs->temperaturemap = (u8 *)(base + temperaturemap);
+  gs->biomemap = (u8 *)(base + biomemap);
+  gs->flowdir = (u8 *)(base + flowdir);
+  gs->flowmap = (f32 *)(base + flowmap);
+  gs->rivermap = (u8 *)(base + rivermap);
+  gs->erosion_scratch = (f32 *)(base + erosion_scratch);
+  gs->map_data = (Color *)(base + map_data);
+  gs->landmark_dist = (f32 *)(base + landmark_dist);
+  LayOutPyramid(gs, base, pyramid);
+
+  gs->map_data_img.data = gs->map_data;
+  gs->map_data_img.width = width;
+  gs->map_data_img.height = height;
+  gs->map_data_img.mipmaps = 1;
+  gs->map_data_img.format = UNCOMPRESSED_R8G8B8A8;
+  return true;
+}
+
+// Frees everything the state owns, the layers go with its arena
+void DestroyGameState(GameState *gs)
+{
+  delete gs->path;
+  if (gs->flowfields) ClearFlowFieldCache(gs->flowfields);
+  delete gs->flowfields;
+  delete gs->path_cache;
+  delete gs;
 }
 // End Map Funcs ---------------------------------------------------------------
 
@@ -38,301 +95,583 @@ f32 ridgenoise(f64 x, f64 y)
   return 2.0 * (1.0 - fabs(1.0 - noise(x, y)));
 }
 
-void GenerateHeightMap(GameState *gs)
+// x^1.5 and x^3.5 as products and square roots, which IEEE rounds the same
+// everywhere, unlike pow()
+f64 Pow1_5(f64 x)
 {
-  // Generate a random offset based on seed
-  srand(gs->seed);
-  i32 xoffset = rand() % 2048;
-  i32 yoffset = rand() % 2048;
+  return x * sqrt(x);
+}
 
-  // loop through every location
-  for(u32 y = 0; y < gs->map_height; y++)
-  {
-    for(u32 x = 0; x < gs->map_width; x++)
-    {
-      // generate inital noise layer
-      f32 frequency = 2.0;
-      u32 octaves = 3;
-      f32 amplitude = 1.0;
-      f32 range = 1.0;
+f64 Pow3_5(f64 x)
+{
+  return x * x * x * sqrt(x);
+}
 
-      f32 posx = ((x / (f32)gs->map_width) - 0.5) * frequency;
-      f32 posy = ((y / (f32)gs->map_height) - 0.5) * frequency;
+// atan() for x >= 0 from + - * / alone, so every platform gets the same slope
+// map. Abramowitz and Stegun 4.4.49, within 1e-5 radians.
+f64 Atan(f64 x)
+{
+  bool inverted = x > 1.0;
+  if (inverted) x = 1.0 / x;
+  f64 x2 = x * x;
+  f64 a = x * (0.9998660 + x2 * (-0.3302995 + x2 * (0.1801410 + x2 * (-0.0851330 + x2 * 0.0208351))));
+  return inverted ? 1.57079632679489662 - a : a;
+}
 
-      f32 n = noise(posx + xoffset, posy + yoffset);
+// Offset into the noise for one layer of an island
+void NoiseOffset(u32 seed, u64 stream, i32 *xoffset, i32 *yoffset)
+{
+  Random rng;
+  SeedRandom(&rng, seed, stream);
+  *xoffset = RandomBelow(&rng, 2048);
+  *yoffset = RandomBelow(&rng, 2048);
+}
 
-      // layer more noise onto the inital noise to create a more organic image
-      for(u32 o = 0; o < octaves; o++)
-      {
-        frequency = frequency * 2.0;
-        amplitude = amplitude * 0.5;
-        range = range + amplitude;
-        n = n + 0.5 * ridgenoise(posx * frequency, posy * frequency)
-          * amplitude * n;
-        n = n + 0.5 * noise(posx * frequency, posy * frequency)
-          * amplitude;
-      }
-      n = n / range;
+// Height of cell (x, y) of a width x height island
+f32 HeightAt(u32 x, u32 y, u32 width, u32 height, i32 xoffset, i32 yoffset)
+{
+  // generate inital noise layer
+  f32 frequency = 2.0;
+  u32 octaves = 3;
+  f32 amplitude = 1.0;
+  f32 range = 1.0;
+
+  f32 posx = ((x / (f32)width) - 0.5) * frequency;
+  f32 posy = ((y / (f32)height) - 0.5) * frequency;
+
+  f32 n = noise(posx + xoffset, posy + yoffset);
+
+  // layer more noise onto the inital noise to create a more organic image
+  for(u32 o = 0; o < octaves; o++)
+  {
+    frequency = frequency * 2.0;
+    amplitude = amplitude * 0.5;
+    range = range + amplitude;
+    n = n + 0.5 * ridgenoise(posx * frequency, posy * frequency)
+      * amplitude * n;
+    n = n + 0.5 * noise(posx * frequency, posy * frequency)
+      * amplitude;
+  }
+  n = n / range;
 
-      // use upper and lower bounding functions to further shape noise
-      // d = normalizeDistance(x, y, width / 2, height / 2);
-      f32 d = sqrt(pow((gs->map_width / 2.0) - x, 2.0)
-          + pow((gs->map_height / 2.0) - y, 2.0))
-        / (gs->map_width / 2.0);
+  // use upper and lower bounding functions to further shape noise
+  // d = normalizeDistance(x, y, width / 2, height / 2);
+  f64 dx = (width / 2.0) - x;
+  f64 dy = (height / 2.0) - y;
+  f32 d = sqrt(dx * dx + dy * dy) / (width / 2.0);
 
-      // n = n * (upper(d) - lower(d)) + lower(d);
-      //n = n * ((1 - pow(d, 3.5)) - (1 - fabs(d))) + 0.4 * (1 - fabs(d));
-      n = n * ((1 - pow(d, 3.5)) - (1 - pow(d, 1.5))) + 0.4 * (1 - pow(d, 1.5));
+  // n = n * (upper(d) - lower(d)) + lower(d);
+  //n = n * ((1 - pow(d, 3.5)) - (1 - fabs(d))) + 0.4 * (1 - fabs(d));
+  n = n * ((1 - Pow3_5(d)) - (1 - Pow1_5(d))) + 0.4 * (1 - Pow1_5(d));
 
 
-      n = Clamp(n, 0, 1);
-      n = pow(n, 1.5);
-      n *= 2550.0;
+  n = Clamp(n, 0, 1);
+  n = Pow1_5(n);
+  n *= 2550.0;
+  return n;
+}
 
+void GenerateHeightMap(GameState *gs)
+{
+  // Generate a random offset based on seed
+  i32 xoffset, yoffset;
+  NoiseOffset(gs->seed, STREAM_HEIGHT, &xoffset, &yoffset);
+
+  // loop through every location
+  for(u32 y = 0; y < gs->map_height; y++)
+  {
+    for(u32 x = 0; x < gs->map_width; x++)
+    {
       // assign the generated noise data to its tile
-      gs->heightmap[y * gs->map_width + x] = n;
+      gs->heightmap[y * gs->map_width + x] =
+        HeightAt(x, y, gs->map_width, gs->map_height, xoffset, yoffset);
 } } }
 
-void GenerateSlopeMap(GameState *gs)
+// Mean slope in degrees between cell (x, y) and its neighbors on the map,
+// `h` points at the cell's height in rows `stride` apart
+u32 SlopeAt(const f32 *h, u32 x, u32 y, u32 width, u32 height, i64 stride)
 {
   f32 radtopi = 180.0 / 3.14159265;
+  // nw, n, ne, e, se, s, sw, w
+  const i32 dx[8] = {-1, 0, 1, 1, 1, 0, -1, -1};
+  const i32 dy[8] = {-1, -1, -1, 0, 1, 1, 1, 0};
 
-  for (u32 i = 0; i < gs->map_width * gs->map_height; i++)
+  f32 sum = 0.0;
+  u32 num_neighbors = 0;
+  for (u32 k = 0; k < 8; k++)
   {
-    f32 nw = 0.0;
-    f32 n = 0.0;
-    f32 ne = 0.0;
-    f32 e = 0.0;
-    f32 se = 0.0;
-    f32 s = 0.0;
-    f32 sw = 0.0;
-    f32 w = 0.0;
-    u32 num_neighbors = 0.0;
+    i64 nx = (i64)x + dx[k];
+    i64 ny = (i64)y + dy[k];
+    if (nx < 0 || ny < 0 || nx >= width || ny >= height) continue;
+    sum += (f32)(Atan(fabs(h[0] - h[dy[k] * stride + dx[k]]) / 10.0) * radtopi);
+    num_neighbors += 1;
+  }
+  return sum / (f32)num_neighbors;
+}
 
-    if (ValidNeighbor(i - 1 - gs->map_width, gs->map_width, gs->map_height))
-    {
-      nw = atan(fabs(gs->heightmap[i] - gs->heightmap[i - 1 - gs->map_width]) / 10.0)
-        * radtopi;
-      num_neighbors += 1;
-    }
-    if (ValidNeighbor(i - gs->map_width, gs->map_width, gs->map_height))
-    {
-      n = atan(fabs(gs->heightmap[i] - gs->heightmap[i - gs->map_width]) / 10.0) * radtopi;
-      num_neighbors += 1;
-    }
-    if (ValidNeighbor(i + 1 - gs->map_width, gs->map_width, gs->map_height))
-    {
-      ne = atan(fabs(gs->heightmap[i] - gs->heightmap[i + 1 - gs->map_width]) / 10.0) * radtopi;
-      num_neighbors += 1;
-    }
-    if (ValidNeighbor(i + 1, gs->map_width, gs->map_height))
-    {
-      e = atan(fabs(gs->heightmap[i] - gs->heightmap[i + 1]) / 10.0) * radtopi;
-      num_neighbors += 1;
-    }
-    if (ValidNeighbor(i + 1 + gs->map_width, gs->map_width, gs->map_height))
-    {
-      se = atan(fabs(gs->heightmap[i] - gs->heightmap[i + 1 + gs->map_width]) / 10.0) * radtopi;
-      num_neighbors += 1;
-    }
-    if (ValidNeighbor(i + gs->map_width, gs->map_width, gs->map_height))
-    {
-      s = atan(fabs(gs->heightmap[i] - gs->heightmap[i + gs->map_width]) / 10.0) * radtopi;
-      num_neighbors += 1;
-    }
-    if (ValidNeighbor(i - 1 + gs->map_width, gs->map_width, gs->map_height))
-    {
-      sw = atan(fabs(gs->heightmap[i] - gs->heightmap[i - 1 + gs->map_width]) / 10.0) * radtopi;
-      num_neighbors += 1;
-    }
-    if (ValidNeighbor(i - 1, gs->map_width, gs->map_height))
+void GenerateSlopeMap(GameState *gs)
+{
+  for (u32 y = 0; y < gs->map_height; y++)
+  {
+    for (u32 x = 0; x < gs->map_width; x++)
     {
-      w = atan(fabs(gs->heightmap[i] - gs->heightmap[i - 1]) / 10.0) * radtopi;
-      num_neighbors += 1;
-    }
+      i32 index = y * gs->map_width + x;
+      gs->slopemap[index] = SlopeAt(&gs->heightmap[index], x, y, gs->map_width, gs->map_height, gs->map_width);
+} } }
 
-    gs->slopemap[i] = (nw + n + ne + e + se + s + sw + w) / (f32)num_neighbors;
-} }
+// Rain on cell (x, y) of a width x height island, 0-255
+u8 WaterAt(u32 x, u32 y, u32 width, u32 height, i32 xoffset, i32 yoffset)
+{
+  // generate inital noise layer
+  f32 frequency = 2.0;
+  u32 octaves = 3;
+  f32 amplitude = 1.0;
+  f32 range = 1.0;
+
+  f32 posx = ((x / (f32)width) - 0.5) * frequency;
+  f32 posy = ((y / (f32)height) - 0.5) * frequency;
+
+  f32 n = noise(posx + xoffset, posy + yoffset);
+
+  // layer more noise onto the inital noise to create a more organic image
+  for(u32 o = 0; o < octaves; o++)
+  {
+    frequency = frequency * 2.0;
+    amplitude = amplitude * 0.5;
+    range = range + amplitude;
+    n = n + 0.5 * ridgenoise(posx * frequency, posy * frequency)
+      * amplitude * n;
+    n = n + 0.5 * noise(posx * frequency, posy * frequency)
+      * amplitude;
+  }
+  n = n / range;
+
+  n = Pow1_5(n);
+
+  /*
+  // use upper and lower bounding functions to further shape noise
+  // d = normalizeDistance(x, y, width / 2, height / 2);
+  f32 d = sqrt(pow((width / 2.0) - x, 2.0) + pow((height / 2.0) - y, 2.0))
+    / (width / 2.0);
+
+  // n = n * (upper(d) - lower(d)) + lower(d);
+  n = n * ((1 - pow(d, 3.5)) - (1 - fabs(d))) + 0.4 * (1 - fabs(d));
+  */
+  n = Clamp(n, 0, 1);
+  n = n * n * n;
+  n *= 255.0;
+
+  //u8 adjusted = 255 - (u8)n;
+  u8 adjusted = (u8)n;
+  return adjusted;
+}
 
 void GenerateWaterMap(GameState *gs)
 {
   // Generate a random offset based on seed
-  srand(gs->seed);
-  srand(rand());
-  i32 xoffset = rand() % 2048;
-  i32 yoffset = rand() % 2048;
+  i32 xoffset, yoffset;
+  NoiseOffset(gs->seed, STREAM_WATER, &xoffset, &yoffset);
 
   // loop through every location
   for(u32 y = 0; y < gs->map_height; y++)
   {
     for(u32 x = 0; x < gs->map_width; x++)
     {
-      // generate inital noise layer
-      f32 frequency = 2.0;
-      u32 octaves = 3;
-      f32 amplitude = 1.0;
-      f32 range = 1.0;
-
-      f32 posx = ((x / (f32)gs->map_width) - 0.5) * frequency;
-      f32 posy = ((y / (f32)gs->map_height) - 0.5) * frequency;
+      // assign the generated noise data to its tile
+      gs->watermap[y * gs->map_width + x] =
+        WaterAt(x, y, gs->map_width, gs->map_height, xoffset, yoffset);
+} } }
 
-      f32 n = noise(posx + xoffset, posy + yoffset);
+// Temperature of cell (x, y) from low frequency noise, colder the higher its
+// height h
+u8 TemperatureAt(u32 x, u32 y, u32 width, u32 height, i32 xoffset, i32 yoffset, f32 h)
+{
+  f32 posx = ((x / (f32)width) - 0.5) * 1.5;
+  f32 posy = ((y / (f32)height) - 0.5) * 1.5;
 
-      // layer more noise onto the inital noise to create a more organic image
-      for(u32 o = 0; o < octaves; o++)
-      {
-        frequency = frequency * 2.0;
-        amplitude = amplitude * 0.5;
-        range = range + amplitude;
-        n = n + 0.5 * ridgenoise(posx * frequency, posy * frequency)
-          * amplitude * n;
-        n = n + 0.5 * noise(posx * frequency, posy * frequency)
-          * amplitude;
-      }
-      n = n / range;
+  // broad climate zones with some smaller variation on top
+  f32 n = 0.75 * noise(posx + xoffset, posy + yoffset)
+    + 0.25 * noise(4.0 * posx + xoffset, 4.0 * posy + yoffset);
 
-      n = pow(n, 1.5);
+  // lapse rate, the peaks are always cold
+  f32 e = h / 10.0;
+  n = 0.45 + 0.4 * n - max(e - 20.0f, 0.0f) / 200.0f;
 
-      /*
-      // use upper and lower bounding functions to further shape noise
-      // d = normalizeDistance(x, y, width / 2, height / 2);
-      f32 d = sqrt(pow((width / 2.0) - x, 2.0) + pow((height / 2.0) - y, 2.0))
-        / (width / 2.0);
+  n = Clamp(n, 0, 1);
+  return (u8)(n * 255.0);
+}
 
-      // n = n * (upper(d) - lower(d)) + lower(d);
-      n = n * ((1 - pow(d, 3.5)) - (1 - fabs(d))) + 0.4 * (1 - fabs(d));
-      */
-      n = Clamp(n, 0, 1);
-      n = pow(n, 3.0f);
-      n *= 255.0;
+void GenerateTemperatureMap(GameState *gs)
+{
+  // Generate a random offset based on seed
+  i32 xoffset, yoffset;
+  NoiseOffset(gs->seed, STREAM_TEMPERATURE, &xoffset, &yoffset);
 
-      // assign the generated noise data to its tile
-      //u8 adjusted = 255 - (u8)n;
-      u8 adjusted = (u8)n;
-      gs->watermap[y * gs->map_width + x] = adjusted;
+  for(u32 y = 0; y < gs->map_height; y++)
+  {
+    for(u32 x = 0; x < gs->map_width; x++)
+    {
+      i32 index = y * gs->map_width + x;
+      gs->temperaturemap[index] = TemperatureAt(x, y, gs->map_width, gs->map_height,
+        xoffset, yoffset, gs->heightmap[index]);
 } } }
 
+// Forest grows on wet ground above the coast and below the mountains
+u8 ForestAt(f32 h, u8 water, u8 river)
+{
+  f32 e = h / 10.0;
+  if(e > 25 && e < 70)
+  {
+    // rivers stay open to cross
+    if(water > 55 && !river)
+    {
+      return 1;
+  } }
+  return 0;
+}
+
 void GenerateForestMap(GameState *gs)
 {
-  for(u32 y = 0; y < gs->map_height; y++)
+  for(u32 i = 0; i < gs->map_width * gs->map_height; i++)
   {
-    for(u32 x = 0; x < gs->map_width; x++)
+    gs->forestmap[i] = ForestAt(gs->heightmap[i], gs->watermap[i], gs->rivermap[i]);
+} }
+
+void GenerateWorld(GameState *gs)
+{
+  // the water map is rain for the rivers, slope, temperature and forest
+  // follow the eroded terrain and the biomes come from all of them
+  GenerateHeightMap(gs);
+  GenerateWaterMap(gs);
+  SimulateHydrology(gs);
+  GenerateSlopeMap(gs);
+  GenerateTemperatureMap(gs);
+  GenerateForestMap(gs);
+  ClassifyBiomes(gs, 0, gs->map_width * gs->map_height);
+  BuildPyramid(gs);
+  BuildLandmarks(gs);
+  ClearFlowFieldCache(gs->flowfields);
+  gs->map_version += 1;
+}
+
+// Plants (or clears) forest in a square brush around a cell and reclassifies
+// its biomes. Forest blocks the agents, so cached flow fields get the edit to
+// repair and the landmark tables are rebuilt
+void EditTerrain(GameState *gs, i32 x, i32 y, i32 radius, u8 forest)
+{
+  DirtyRect rect;
+  rect.x0 = max(x - radius, 0);
+  rect.y0 = max(y - radius, 0);
+  rect.x1 = min(x + radius, (i32)gs->map_width - 1);
+  rect.y1 = min(y + radius, (i32)gs->map_height - 1);
+
+  for (i32 j = rect.y0; j <= rect.y1; j++)
+  {
+    for (i32 i = rect.x0; i <= rect.x1; i++)
     {
-      i32 index = y * gs->map_width + x;
-      f32 e = gs->heightmap[index] / 10.0;
-      if(e > 25 && e < 70)
+      i32 index = j * gs->map_width + i;
+      if ((gs->heightmap[index] / 10.0f) > 20.0f)
       {
-        if(gs->watermap[index] > 55)
-        {
-          gs->forestmap[index] = 1;
-        }
-        else
-        {
-          gs->forestmap[index] = 0;
-} } } } }
+        gs->forestmap[index] = forest;
+    } }
+    ClassifyBiomes(gs, j * gs->map_width + rect.x0, j * gs->map_width + rect.x1 + 1);
+  }
+
+  MarkFlowFieldsDirty(gs->flowfields, rect);
+  BuildPyramid(gs);
+  BuildLandmarks(gs);
+  gs->map_version += 1;
+  gs->map_reset = 1;
+}
 // End Proc Gen ----------------------------------------------------------------
 
-void UpdateMapDrawData(GameState *gs)
+// Colour of one cell in a mapmode, e is the elevation / 10, r the river
+// strength and b the biome
+Color MapColor(u32 mapmode, f32 e, u32 s, u8 w, bool f, u8 r, u8 b)
 {
-  for (u32 i = 0; i < gs->map_height * gs->map_width; i++)
+  if (mapmode == HEIGHTMAP)
   {
-    f32 e = gs->heightmap[i] / 10.0;
-
-    if (gs->mapmode == HEIGHTMAP)
+    if (e > 20)
+      return /*(Color)*/{(u8)e, (u8)e, (u8)e, 255};
+    else
+      return /*(Color)*/{(u8)e, (u8)e, 255, 255};
+  }
+  else if (mapmode == SLOPEMAP)
+  {
+    if (e > 60)
     {
-      if (e > 20)
-        gs->map_data[i] = /*(Color)*/{(u8)e, (u8)e, (u8)e, 255};
-      else
-        gs->map_data[i] = /*(Color)*/{(u8)e, (u8)e, 255, 255};
+      if (s > 70) return MAROON;
+      else if (s > 50) return ORANGE;
+      else if (s > 30) return DARKGREEN;
+      else /*(s >= 0)*/ return DARKPURPLE;
     }
-    else if (gs->mapmode == SLOPEMAP)
+    else if (e > 40)
     {
-      u32 s = gs->slopemap[i];
-
-      if (e > 60)
-      {
-        if (s > 70) gs->map_data[i] = MAROON;
-        else if (s > 50) gs->map_data[i] = ORANGE;
-        else if (s > 30) gs->map_data[i] = DARKGREEN;
-        else /*(s >= 0)*/ gs->map_data[i] = DARKPURPLE;
-      }
-      else if (e > 40)
-      {
-        if (s > 70) gs->map_data[i] = RED;
-        else if (s > 50) gs->map_data[i] = GOLD;
-        else if (s > 30) gs->map_data[i] = LIME;
-        else /*(s >= 0)*/ gs->map_data[i] = VIOLET;
-      }
-      else if (e > 20)
-      {
-        if (s > 70) gs->map_data[i] = PINK;
-        else if (s > 50) gs->map_data[i] = YELLOW;
-        else if (s > 30) gs->map_data[i] = GREEN;
-        else /*(s >= 0)*/ gs->map_data[i] = PURPLE;
-      }
-      else
-      {
-        gs->map_data[i] = BLUE;
-    } }
-    else if (gs->mapmode == SIMPLESLOPEMAP)
+      if (s > 70) return RED;
+      else if (s > 50) return GOLD;
+      else if (s > 30) return LIME;
+      else /*(s >= 0)*/ return VIOLET;
+    }
+    else if (e > 20)
+    {
+      if (s > 70) return PINK;
+      else if (s > 50) return YELLOW;
+      else if (s > 30) return GREEN;
+      else /*(s >= 0)*/ return PURPLE;
+    }
+    else
+    {
+      return BLUE;
+  } }
+  else if (mapmode == SIMPLESLOPEMAP)
+  {
+    if (e > 20)
+    {
+      if (s > 60) return RAYWHITE;
+      else if (s > 40) return LIGHTGRAY;
+      else if (s > 20) return BEIGE;
+      else /*(s >= 0)*/ return GREEN;
+    }
+    else
     {
-      u32 s = gs->slopemap[i];
+      return BLUE;
+  } }
+  else if (mapmode == WATERMAP)
+  {
+    if (r && (e > 20)) return DARKBLUE;
+    if (w >= 188) return DARKBLUE;
+    else if (w >= 125) return BLUE;
+    else if (w >= 55) return SKYBLUE;
+    else /*(w >= 0)*/ return YELLOW;
+  }
+  else if (mapmode == FORESTMAP)
+  {
+    if(f && (e > 20)) return DARKGREEN;
+    else if(!f && (e > 20)) return GREEN;
+    else return BLUE;
+  }
+  else /*(mapmode == THEGOODONE)*/
+  {
+    return BIOME_COLORS[b];
+} }
 
-      if (e > 20)
-      {
-        if (s > 60) gs->map_data[i] = RAYWHITE;
-        else if (s > 40) gs->map_data[i] = LIGHTGRAY;
-        else if (s > 20) gs->map_data[i] = BEIGE;
-        else /*(s >= 0)*/ gs->map_data[i] = GREEN;
-      }
-      else
-      {
-        gs->map_data[i] = BLUE;
-    } }
-    else if (gs->mapmode == WATERMAP)
+// Colours pyramid level `level` into map_data and sizes map_data_img to it.
+// Zoomed out levels show their average height and water, the steepest slope
+// under a cell so cliffs don't fade away, and forest where most of it is.
+void UpdateMapDrawData(GameState *gs, u32 level)
+{
+  gs->view_level = level;
+  if (level == 0)
+  {
+    gs->map_data_img.width = gs->map_width;
+    gs->map_data_img.height = gs->map_height;
+    for (u32 i = 0; i < gs->map_height * gs->map_width; i++)
     {
-      u8 w = gs->watermap[i];
+      gs->map_data[i] = MapColor(gs->mapmode, gs->heightmap[i] / 10.0f,
+        gs->slopemap[i], gs->watermap[i], gs->forestmap[i] == 1, gs->rivermap[i],
+        gs->biomemap[i]);
+    }
+    return;
+  }
+
+  PyramidLevel *p = &gs->pyramid[level];
+  gs->map_data_img.width = p->width;
+  gs->map_data_img.height = p->height;
+  for (u32 i = 0; i < p->height * p->width; i++)
+  {
+    gs->map_data[i] = MapColor(gs->mapmode, p->height_avg[i] / 10.0f,
+      p->slope_max[i], p->water_avg[i], p->forest_avg[i] >= 128, p->river_max[i],
+      p->biome[i]);
+  }
+}
 
-      if (w >= 188) gs->map_data[i] = DARKBLUE;
-      else if (w >= 125) gs->map_data[i] = BLUE;
-      else if (w >= 55) gs->map_data[i] = SKYBLUE;
-      else /*(w >= 0)*/ gs->map_data[i] = YELLOW;
+// Plans the agent's route to the target as waypoints, the cell list isn't
+// kept. False when there is no route.
+bool PlanAgentPath(GameState *gs)
+{
+  AStar(gs);
+  SmoothPath(gs);
+  gs->path->clear();
+  gs->path_anchor = gs->waypoints.empty() ? 0 : gs->waypoints[0];
+  gs->path_waypoint = 1;
+  gs->path_step = 0;
+  gs->path_version += 1;
+  return !gs->waypoints.empty();
+}
+
+int main(int argc, char **argv)
+{
+  // Command Line ---------------------------------------------------------
+  bool bench = false;
+  bool hash_layers = false;
+  const char *export_prefix = NULL;
+  const char *serve_path = NULL;
+  u32 serve_workers = max(thread::hardware_concurrency(), 1u);
+  bool simulate = false;
+  u32 simulate_agents = 10000;
+  u32 simulate_ticks = 1000;
+  u32 simulate_edit_every = 100;
+  u32 export_band = 256;
+  u32 export_tile = 1024;
+  u32 export_preview_scale = 0;
+  u32 bench_queries = 1000;
+  u32 seed = 1234;
+  u32 size = 256;
+  for (i32 i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--bench") == 0)
+    {
+      bench = true;
+      if (i + 1 < argc && argv[i + 1][0] != '-') bench_queries = atoi(argv[++i]);
     }
-    else if (gs->mapmode == FORESTMAP)
+    else if (strcmp(argv[i], "--hash-layers") == 0)
     {
-      u8 f = gs->forestmap[i];
-      f32 e = gs->heightmap[i] / 10.0;
-
-      if(f && (e > 20)) gs->map_data[i] = DARKGREEN;
-      else if(!f && (e > 20)) gs->map_data[i] = GREEN;
-      else gs->map_data[i] = BLUE;
+      hash_layers = true;
+    }
+    else if (strcmp(argv[i], "--export") == 0 && i + 1 < argc)
+    {
+      export_prefix = argv[++i];
+    }
+    else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+    {
+      serve_path = argv[++i];
+    }
+    else if (strcmp(argv[i], "--simulate") == 0)
+    {
+      simulate = true;
+      if (i + 1 < argc && argv[i + 1][0] != '-') simulate_agents = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--ticks") == 0 && i + 1 < argc)
+    {
+      simulate_ticks = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--edit-every") == 0 && i + 1 < argc)
+    {
+      simulate_edit_every = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc)
+    {
+      serve_workers = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--band") == 0 && i + 1 < argc)
+    {
+      export_band = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--tile") == 0 && i + 1 < argc)
+    {
+      export_tile = atoi(argv[++i]);
     }
-    else if (gs->mapmode == THEGOODONE)
+    else if (strcmp(argv[i], "--preview-scale") == 0 && i + 1 < argc)
     {
-      u8 f = gs->forestmap[i];
-      u32 s = gs->slopemap[i];
-      f32 e = gs->heightmap[i] / 10.0f;
+      export_preview_scale = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+    {
+      seed = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+    {
+      size = atoi(argv[++i]);
+    }
+    else
+    {
+      printf("Usage: proc-gen [--bench [queries]] [--hash-layers] [--seed n] [--size n]\n"
+        "                [--export prefix [--band rows] [--tile n] [--preview-scale n]]\n"
+        "                [--serve socket [--workers n]]\n"
+        "                [--simulate [agents] [--ticks n] [--edit-every n] [--workers n]]\n");
+      return 1;
+    }
+  }
 
-      if(e > 20)
-      {
-        if (s > 75) gs->map_data[i] = RAYWHITE;
-        else if (s > 63) gs->map_data[i] = LIGHTGRAY;
-        else if (s > 45) gs->map_data[i] = BEIGE;
-        else if (s > 20) gs->map_data[i] = LIME;
-        else /*(s >= 0)*/ gs->map_data[i] = GREEN;
+  // Export ---------------------------------------------------------------
+  if (export_prefix)
+  {
+    ExportSettings settings;
+    settings.prefix = export_prefix;
+    settings.seed = seed;
+    settings.size = max(size, 1u);
+    settings.band_rows = max(export_band, 1u);
+    settings.tile = max(export_tile, 1u);
+    // a preview about 1024 pixels across unless asked otherwise
+    settings.preview_scale = export_preview_scale ? export_preview_scale
+      : max((settings.size + 1023) / 1024, 1u);
+    settings.mapmode = THEGOODONE;
+    return ExportWorld(&settings) ? 0 : 1;
+  }
 
-        if (f) gs->map_data[i] = DARKGREEN;
-      }
-      else
-      {
-        gs->map_data[i] = BLUE;
-  } } }
+  // Initialize State -----------------------------------------------------
+  GameState *gs = new GameState();
+  gs->mapmode = 5;
+  gs->mapmode_new = 0;
+  gs->map_reset = 0;
+  gs->seed = seed;
+  gs->new_target_set = false;
+  gs->invalid_player_pos = false;
+  gs->player_pos = /*(Vector2)*/{(f32)(size / 2), (f32)(size / 2)};
+  gs->target_pos = /*(Vector2)*/{0, 0};
+  gs->path = NULL;
+  gs->search_mode = SEARCH_4DIR;
+  gs->cost_model = COST_HEIGHT;
+  gs->path_anchor = 0;
+  gs->path_waypoint = 0;
+  gs->path_step = 0;
+  gs->path_version = 0;
+  gs->use_landmarks = true;
+  gs->bidirectional = false;
+  gs->search_log = !bench && !serve_path && !simulate;
+  gs->search_expansions = 0;
+  gs->path_cost = 0.0;
 
-  gs->map_data_img = LoadImageEx(gs->map_data, gs->map_width, gs->map_height);
-}
+  // Generate World ------------------------------------------------------------
+
+  if (!AllocateWorld(gs, size, size))
+  {
+    printf("Not enough memory for a %ux%u world\n", size, size);
+    DestroyGameState(gs);
+    return 1;
+  }
+  gs->flowfields = CreateFlowFieldCache(FLOWFIELD_CACHE_SIZE);
+  gs->use_path_cache = true;
+  gs->path_cache = CreatePathCache(PATH_CACHE_SIZE);
+  gs->map_version = 0;
+
+  if (hash_layers)
+  {
+    u32 failed = RunLayerHashes(gs);
+    DestroyGameState(gs);
+    return failed ? 1 : 0;
+  }
+
+  GenerateWorld(gs);
+
+  if (serve_path)
+  {
+    bool served = RunServer(gs, serve_path, serve_workers);
+    DestroyGameState(gs);
+    return served ? 0 : 1;
+  }
+
+  if (simulate)
+  {
+    RunSimulation(gs, simulate_agents, simulate_ticks, simulate_edit_every, serve_workers);
+    DestroyGameState(gs);
+    return 0;
+  }
+
+  if (bench)
+  {
+    RunPathBenchmark(gs, bench_queries);
+    RunFlowFieldBenchmark(gs, bench_queries);
+    RunPathCacheBenchmark(gs, bench_queries);
+    RunGridKernelBenchmark(gs, bench_queries);
+    RunPyramidBenchmark(gs);
+    RunPathSmoothingBenchmark(gs, bench_queries);
+    RunHydrologyBenchmark(gs);
+    RunBiomeBenchmark(gs);
+    DestroyGameState(gs);
+    return 0;
+  }
 
-int main(void)
-{
   // Create Window
   const i32 screenWidth = 1920;
   const i32 screenHeight = 1000;
@@ -352,40 +691,21 @@ int main(void)
   //camera.rotation = 0.0f;
   //camera.zoom = 1.0f;
 
-  // Initialize State -----------------------------------------------------
-  GameState *gs = (GameState *)malloc(sizeof(GameState));
-  gs->mapmode = 5;
-  gs->mapmode_new = 0;
-  gs->map_reset = 0;
-  gs->map_height = 256;
-  gs->map_width = 256;
-  gs->seed = 1234;
-  gs->new_target_set = false;
-  gs->invalid_player_pos = false;
-  gs->player_pos = /*(Vector2)*/{128, 128};
-  gs->target_pos = /*(Vector2)*/{0, 0};
-
-  // Generate World ------------------------------------------------------------
-
-  // type arr_name[width * height]; is equivalent to:
-  // type *arr_name = malloc(width * height * sizeof(type));
-  gs->heightmap = (f32 *)malloc(gs->map_width * gs->map_height * sizeof(f32));
-  gs->slopemap = (u32 *)malloc(gs->map_width * gs->map_height * sizeof(u32));
-  gs->watermap = (u8 *)malloc(gs->map_width * gs->map_height * sizeof(u8));
-  gs->forestmap = (u8 *)malloc(gs->map_width * gs->map_height * sizeof(u8));
-
-  GenerateHeightMap(gs);
-  GenerateSlopeMap(gs);
-  GenerateWaterMap(gs);
-  GenerateForestMap(gs);
-
   // To display world
-  gs->map_data = (Color *)malloc(gs->map_width * gs->map_height * sizeof(Color));
   Texture2D map_tex = {0};
 
-  UpdateMapDrawData(gs);
+  UpdateMapDrawData(gs, PyramidLevelForScale(gs, scale));
   map_tex = LoadTextureFromImage(gs->map_data_img);
-  //UnloadImage(gs->map_data_img);
+
+  PathOverlay path_overlay;
+  LoadPathOverlay(&path_overlay, gs->map_width, gs->map_height);
+  HudPanel hud_panel;
+  LoadHudPanel(&hud_panel);
+  HudLine cursor_line = {};
+  HudLine player_line = {};
+  HudLine target_line = {};
+  HudLine search_line = {};
+  HudLine cache_line = {};
 
   while (!WindowShouldClose())
   {
@@ -410,13 +730,53 @@ int main(void)
     {
       gs->mapmode_new = 5;
     }
+    if (IsKeyDown(KEY_ONE))
+    {
+      gs->search_mode = SEARCH_4DIR;
+    }
+    if (IsKeyDown(KEY_TWO))
+    {
+      gs->search_mode = SEARCH_8DIR;
+    }
+    if (IsKeyDown(KEY_THREE))
+    {
+      gs->search_mode = SEARCH_THETA;
+    }
+    if (IsKeyDown(KEY_FOUR))
+    {
+      gs->search_mode = SEARCH_LAZY_THETA;
+    }
+    if (IsKeyDown(KEY_FIVE))
+    {
+      gs->search_mode = SEARCH_FLOWFIELD;
+    }
+    if (IsKeyPressed(KEY_L))
+    {
+      gs->use_landmarks = !gs->use_landmarks;
+    }
+    if (IsKeyPressed(KEY_B))
+    {
+      gs->bidirectional = !gs->bidirectional;
+    }
+    if (IsKeyPressed(KEY_M))
+    {
+      gs->cost_model = (gs->cost_model + 1) % 4;
+    }
+    if (IsKeyPressed(KEY_C))
+    {
+      gs->use_path_cache = !gs->use_path_cache;
+    }
+    // the HUD and the path cache then show the search that really runs
+    UseSupportedSearch(gs);
+
+    // Zoom by powers of two, so each pyramid level lines up with a zoom step
+    f32 wheel = GetMouseWheelMove();
+    if (wheel > 0 && scale < 12) scale *= 2;
+    else if (wheel < 0 && scale > 0.1f) scale *= 0.5f;
     if (IsKeyDown(KEY_R))
     {
       gs->seed = rand();
-      GenerateHeightMap(gs);
-      GenerateSlopeMap(gs);
-      GenerateWaterMap(gs);
-      GenerateForestMap(gs);
+      GenerateWorld(gs);
       gs->map_reset = 1;
       if((gs->heightmap[Index(gs->player_pos, gs->map_width)] / 10.0f) <= 20.0f)
       {
@@ -444,11 +804,19 @@ int main(void)
       {
         // Set Pathfinding Target
         gs->target_pos = pos;
-        AStar(gs);
-        if(!gs->path->empty()){
+        if(PlanAgentPath(gs)){
           gs->new_target_set = true;
         }
       }
+      else if(IsKeyPressed(KEY_E) || IsKeyPressed(KEY_Q))
+      {
+        // Plant or clear forest, then replan around it
+        EditTerrain(gs, (i32)pos.x, (i32)pos.y, 2, IsKeyPressed(KEY_E) ? 1 : 0);
+        if(gs->new_target_set)
+        {
+          gs->new_target_set = PlanAgentPath(gs);
+        }
+      }
       else if(IsMouseButtonReleased(MOUSE_RIGHT_BUTTON))
       {
         // Set Player Position
@@ -469,144 +837,142 @@ int main(void)
     BeginDrawing();
     ClearBackground(DARKGRAY);
 
-    if((gs->mapmode_new != gs->mapmode) || gs->map_reset)
+    u32 level = PyramidLevelForScale(gs, scale);
+    if((gs->mapmode_new != gs->mapmode) || gs->map_reset || level != gs->view_level)
     {
       gs->mapmode = gs->mapmode_new;
       gs->map_reset = 0;
-      UpdateMapDrawData(gs);
-      UpdateTexture(map_tex, gs->map_data_img.data);
-      UnloadImage(gs->map_data_img);
-    }
+      bool resized = (level != gs->view_level);
+      UpdateMapDrawData(gs, level);
+      if (resized)
+      {
+        UnloadTexture(map_tex);
+        map_tex = LoadTextureFromImage(gs->map_data_img);
+      }
+      else
+      {
+        UpdateTexture(map_tex, gs->map_data);
+    } }
 
-    DrawTextureEx(map_tex, origin, 0, scale, WHITE);
+    DrawTextureEx(map_tex, origin, 0, scale * (1 << gs->view_level), WHITE);
 
     if(gs->new_target_set)
     {
       if((gs->player_pos.x != gs->target_pos.x) || (gs->player_pos.y != gs->target_pos.y))
       {
-        i32 temp = gs->path->front();
+        // waypoints skip cells, walk the segment one cell per frame
+        i32 next = gs->waypoints[gs->path_waypoint];
+        gs->path_step += 1;
+        i32 temp = LineCell(
+          gs->path_anchor % gs->map_width, gs->path_anchor / gs->map_width,
+          next % gs->map_width, next / gs->map_width,
+          gs->path_step, gs->map_width);
         gs->player_pos.x = temp % gs->map_width;
         gs->player_pos.y = temp / gs->map_width;
-        gs->path->pop_front();
+        if(temp == next)
+        {
+          gs->path_anchor = next;
+          gs->path_step = 0;
+          gs->path_waypoint += 1;
+        }
       }
       else if((gs->player_pos.x == gs->target_pos.x) || (gs->player_pos.y == gs->target_pos.y))
       {
         gs->new_target_set = false;
       }
-
-      for (std::list<int>::iterator it=gs->path->begin(); it != gs->path->end(); ++it)
-      {
-        DrawRectangleV(Vector2Scale(/*(Vector2)*/{(f32)(*it % gs->map_width), (f32)(*it / gs->map_width)}, scale), /*(Vector2)*/{scale, scale}, ORANGE);
-      }
     }
 
+    UpdatePathOverlay(&path_overlay, gs);
+    DrawPath(&path_overlay, gs, origin, scale);
     DrawRectangleV(Vector2Scale(gs->player_pos, scale), /*(Vector2)*/{scale, scale}, MAGENTA);
 
-    char textstr[1024];
+    Vector2 hud = /*(Vector2)*/{origin.x + 10 + (scale * gs->map_width), origin.y};
     i32 cursorx = (i32)trunc(cursorposition.x);
     i32 cursory = (i32)trunc(cursorposition.y);
-    sprintf(
-      textstr, "Mouse Pos: %d, %d || Elevation: %f, Slope: %d, Moisture: %d",
-      cursorx,
-      cursory,
-      gs->heightmap[cursorx + cursory * gs->map_width],
-      gs->slopemap[cursorx + cursory * gs->map_width],
-      gs->watermap[cursorx + cursory * gs->map_width]);
-    DrawText(
-      textstr, origin.x + 10, origin.y + (scale * gs->map_height), 24, BLACK
-    );
-
-
-    char playerstr[1024];
-    sprintf(
-      playerstr, "Player Pos: %d, %d",
-      (i32)(gs->player_pos.x),
-      (i32)(gs->player_pos.y)
-    );
-    DrawText(
-      playerstr, origin.x + 10 + (scale * gs->map_width),
-      origin.y + 10, 24, BLACK
-    );
-
-    char targetstr[1024];
-    sprintf(
-      targetstr, "Target Pos: %d, %d",
-      (i32)(gs->target_pos.x),
-      (i32)(gs->target_pos.y)
-    );
+    i32 cursorI = cursorx + cursory * gs->map_width;
+    if (HudLineStale(&cursor_line, cursorx, cursory, gs->map_version, 0))
+    {
+      snprintf(
+        cursor_line.text, sizeof(cursor_line.text),
+        "Mouse Pos: %d, %d || Elevation: %f, Slope: %d, Moisture: %d, Temperature: %d, Biome: %s",
+        cursorx,
+        cursory,
+        gs->heightmap[cursorI],
+        gs->slopemap[cursorI],
+        gs->watermap[cursorI],
+        gs->temperaturemap[cursorI],
+        BIOME_NAMES[gs->biomemap[cursorI]]);
+    }
     DrawText(
-      targetstr, origin.x + 10 + (scale * gs->map_width),
-      origin.y + 34, 24, BLACK
+      cursor_line.text, origin.x + 10, origin.y + (scale * gs->map_height), 24, BLACK
     );
 
-    if(gs->invalid_player_pos)
+    if (HudLineStale(&player_line, (i32)gs->player_pos.x, (i32)gs->player_pos.y, 0, 0))
     {
-      char errorstr[1024];
-      sprintf(
-        errorstr, "You are trying to place the agent\non a forest or in the ocean\nwhich is not a valid position"
-      );
-      DrawText(
-        errorstr, origin.x + 10 + (scale * gs->map_width),
-        origin.y + 58, 24, RED
+      snprintf(
+        player_line.text, sizeof(player_line.text), "Player Pos: %d, %d",
+        (i32)(gs->player_pos.x),
+        (i32)(gs->player_pos.y)
       );
     }
+    DrawText(player_line.text, hud.x, hud.y + 10, 24, BLACK);
 
-    char helpstr[1024];
-    sprintf(
-      helpstr, "Mapmodes and other buttons:\nLeftClick: pathfind to clicked grid cell\nRightClick: move agent to clicked grid cell\nA: Heightmap\nS: Slopemap\nD: Watermap\nF: Forestmap\nG: Fancymap"
-    );
-    DrawText(
-      helpstr, origin.x + 10 + (scale * gs->map_width),
-      origin.y + 200, 24, BLACK
-    );
-
+    if (HudLineStale(&target_line, (i32)gs->target_pos.x, (i32)gs->target_pos.y, 0, 0))
+    {
+      snprintf(
+        target_line.text, sizeof(target_line.text), "Target Pos: %d, %d",
+        (i32)(gs->target_pos.x),
+        (i32)(gs->target_pos.y)
+      );
+    }
+    DrawText(target_line.text, hud.x, hud.y + 34, 24, BLACK);
 
-    char legendstr[1024];
-    sprintf(
-      legendstr, "Legend:"
-    );
-    DrawText(
-      legendstr, origin.x + 10 + (scale * gs->map_width),
-      origin.y + 600, 24, YELLOW
-    );
+    if (HudLineStale(&search_line, SearchSettings(gs), 0, 0, 0))
+    {
+      const char *searchnames[] = {"4-dir", "8-dir", "Theta*", "Lazy Theta*", "Flow field"};
+      const char *costnames[] = {"height", "slope", "moisture", "biome"};
+      snprintf(
+        search_line.text, sizeof(search_line.text), "Search: %s, %s cost%s%s",
+        searchnames[gs->search_mode],
+        costnames[gs->cost_model],
+        gs->use_landmarks ? ", landmarks" : "",
+        gs->bidirectional ? ", bidirectional" : ""
+      );
+    }
+    DrawText(search_line.text, hud.x, hud.y + 152, 24, BLACK);
 
-    char legend2str[1024];
-
-    switch(gs->mapmode)
-    {
-      case HEIGHTMAP:
-      sprintf(
-        legend2str, "Heightmap: Black = Low Elevation, White = High Elevation, Blue = Water"
-      );break;
-      case SLOPEMAP:
-      sprintf(
-        legend2str, "Slopemap: Darker Color = Higher Elevation, Lighter Color = Lower Elevation\nPurple->Green->Yellow->Red : Slope increases left to right"
-      );break;
-      case WATERMAP:
-      sprintf(
-        legend2str, "Watermap: Darker BLUE = More Rain"
-      );break;
-      case FORESTMAP:
-      sprintf(
-        legend2str, "ForestMap: Light Green = No forest, Dark Green = forest"
-      );break;
-      case THEGOODONE:
-      sprintf(
-        legend2str, "Fancymap: It just looks pretty"
-      );break;
+    if (HudLineStale(&cache_line, gs->use_path_cache, gs->path_cache->hits,
+      gs->path_cache->subpath_hits, gs->path_cache->misses))
+    {
+      snprintf(
+        cache_line.text, sizeof(cache_line.text), "Path cache%s: %llu hits, %llu sub-path hits, %llu misses",
+        gs->use_path_cache ? "" : " (off)",
+        (unsigned long long)gs->path_cache->hits,
+        (unsigned long long)gs->path_cache->subpath_hits,
+        (unsigned long long)gs->path_cache->misses
+      );
     }
+    DrawText(cache_line.text, hud.x, hud.y + 176, 24, BLACK);
 
+    if(gs->invalid_player_pos)
+    {
+      DrawText(
+        "You are trying to place the agent\non a forest or in the ocean\nwhich is not a valid position",
+        hud.x, hud.y + 58, 24, RED
+      );
+    }
 
-    DrawText(
-      legend2str, origin.x + 10 + (scale * gs->map_width),
-      origin.y + 624, 24, YELLOW
-    );
+    DrawHudPanel(&hud_panel, gs->mapmode, /*(Vector2)*/{hud.x, hud.y + 200});
 
     DrawFPS(1840, 10);
     EndDrawing();
     // End Render --------------------------------------------------------------
   }
 
+  UnloadRenderTexture(hud_panel.target);
+  UnloadRenderTexture(path_overlay.target);
+  UnloadTexture(map_tex);
   CloseWindow();
+  DestroyGameState(gs);
   return 0;
 }
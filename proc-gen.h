@@ -1,7 +1,13 @@
 #ifndef PROC_GEN_H
 #define PROC_GEN_H
 
+#include <vector>
+
 #include "typenames.h"
+#include "world-arena.h"
+
+struct FlowFieldCache;
+struct PathCache;
 
 #define HEIGHTMAP      0
 #define SLOPEMAP       1
@@ -9,6 +15,43 @@
 #define WATERMAP       3
 #define FORESTMAP      4
 #define THEGOODONE     5
+
+#define SEARCH_4DIR       0
+#define SEARCH_8DIR       1
+#define SEARCH_THETA      2
+#define SEARCH_LAZY_THETA 3
+#define SEARCH_FLOWFIELD  4
+
+#define COST_HEIGHT   0
+#define COST_SLOPE    1
+#define COST_MOISTURE 2
+#define COST_BIOME    3
+
+#define MAX_LANDMARKS 16
+
+// level 0 is the full resolution map, see pyramid.h
+#define MAX_PYRAMID_LEVELS 16
+
+// One level of the world pyramid, a cell summarises up to 2x2 cells of the
+// level below
+typedef struct PyramidLevel
+{
+  u32 width;
+  u32 height;
+  f32 *height_min;
+  f32 *height_max;
+  f32 *height_avg;
+  u32 *slope_max;
+  u32 *slope_avg;
+  u8  *water_min;
+  u8  *water_max;
+  u8  *water_avg;
+  u8  *forest_avg; // forested fraction, 0-255
+  u8  *river_max;
+  u8  *biome;      // most common biome
+  u8  *passable;   // fraction neither forest nor water, 0-255
+} PyramidLevel;
+
 typedef struct GameState
 {
   u32 seed;
@@ -20,6 +63,18 @@ typedef struct GameState
   bool new_target_set;
   Vector2 target_pos;
   std::list<int> *path;
+  std::vector<i32> waypoints; // path smoothed for the agent, see path-smooth.h
+  u32 search_mode;
+  u32 cost_model;
+  i32 path_anchor;   // waypoint the agent is currently walking away from
+  u32 path_waypoint; // index of the waypoint it is walking to
+  u32 path_step;     // cells walked along the current segment
+  u32 path_version;  // bumped by every PlanAgentPath()
+  bool use_landmarks;
+  bool bidirectional;
+  bool search_log;
+  u32 search_expansions;
+  f64 path_cost;
 
   u32 mapmode;
   u32 mapmode_new;
@@ -28,9 +83,37 @@ typedef struct GameState
   u32 *slopemap;
   u8  *watermap;
   u8  *forestmap;
+  u8  *temperaturemap;
+  u8  *biomemap;  // see biome.h
+
+  // drainage, see hydrology.h
+  u8  *flowdir;   // neighbor each cell drains to, HYDRO_SINK for none
+  f32 *flowmap;   // rain collected upstream, in reference cells of area
+  u8  *rivermap;  // river strength, 0 where there is none
+  f32 *erosion_scratch;
+
+  // coarser copies of the layers above, pyramid[1..pyramid_levels]
+  u32 pyramid_levels;
+  PyramidLevel pyramid[MAX_PYRAMID_LEVELS];
+  u32 view_level; // pyramid level map_data was coloured from
+
+  // ALT heuristic tables, landmark_dist[cell * num_landmarks + l] is the 8-dir
+  // path cost between landmark l and the cell (INFINITY when unreachable)
+  u32 num_landmarks;
+  i32 landmarks[MAX_LANDMARKS];
+  f32 *landmark_dist;
+
+  // flow fields of recent targets, see flowfield.h
+  FlowFieldCache *flowfields;
+  bool use_path_cache;
+  PathCache *path_cache;
+  u32 map_version; // bumped on every regeneration and edit
 
   Color *map_data;
-  Image map_data_img;
+  Image map_data_img; // wraps map_data, for the texture upload
+
+  // owns the layers above, see AllocateWorld
+  WorldArena arena;
 } GameState;
 
 #endif
@@ -0,0 +1,183 @@
+#ifndef PYRAMID_H
+#define PYRAMID_H
+
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+#include "proc-gen.h"
+#include "grid.h"
+#include "world-arena.h"
+#include "biome.h"
+
+// Mipmap style pyramid of the world layers. Each level halves the one below,
+// a cell covering up to 2x2 cells of it and keeping their min, max and
+// average, and their most common biome. The renderer draws the level
+// matching the zoom.
+
+using namespace std;
+
+// Number of levels above the full resolution map, down to about 8x8
+u32 PyramidLevelCount(u32 width, u32 height)
+{
+  u32 levels = 0;
+  while ((width > 8 || height > 8) && levels + 1 < MAX_PYRAMID_LEVELS)
+  {
+    width = (width + 1) / 2;
+    height = (height + 1) / 2;
+    levels += 1;
+  }
+  return levels;
+}
+
+// Layout of one level, every layer on its own cache line
+size_t LayOutPyramidLevel(PyramidLevel *level, u8 *base, size_t offset)
+{
+  size_t cells = (size_t)level->width * level->height;
+  size_t f32s = AlignUp(cells * sizeof(f32), ARENA_ALIGN);
+  size_t u32s = AlignUp(cells * sizeof(u32), ARENA_ALIGN);
+  size_t u8s = AlignUp(cells * sizeof(u8), ARENA_ALIGN);
+  if (base)
+  {
+    level->height_min = (f32 *)(base + offset);
+    level->height_max = (f32 *)(base + offset + f32s);
+    level->height_avg = (f32 *)(base + offset + 2 * f32s);
+    level->slope_max = (u32 *)(base + offset + 3 * f32s);
+    level->slope_avg = (u32 *)(base + offset + 3 * f32s + u32s);
+    level->water_min = base + offset + 3 * f32s + 2 * u32s;
+    level->water_max = base + offset + 3 * f32s + 2 * u32s + u8s;
+    level->water_avg = base + offset + 3 * f32s + 2 * u32s + 2 * u8s;
+    level->forest_avg = base + offset + 3 * f32s + 2 * u32s + 3 * u8s;
+    level->passable = base + offset + 3 * f32s + 2 * u32s + 4 * u8s;
+    level->river_max = base + offset + 3 * f32s + 2 * u32s + 5 * u8s;
+    level->biome = base + offset + 3 * f32s + 2 * u32s + 6 * u8s;
+  }
+  return offset + 3 * f32s + 2 * u32s + 7 * u8s;
+}
+
+// Sets the level sizes and, given the arena block, their layer pointers.
+// Returns the end offset of the pyramid.
+size_t LayOutPyramid(GameState *gs, u8 *base, size_t offset)
+{
+  gs->pyramid_levels = PyramidLevelCount(gs->map_width, gs->map_height);
+  u32 width = gs->map_width;
+  u32 height = gs->map_height;
+  for (u32 l = 1; l <= gs->pyramid_levels; l++)
+  {
+    width = (width + 1) / 2;
+    height = (height + 1) / 2;
+    gs->pyramid[l].width = width;
+    gs->pyramid[l].height = height;
+    offset = LayOutPyramidLevel(&gs->pyramid[l], base, offset);
+  }
+  return offset;
+}
+
+// Fills rows [y0, y1) of level `l` from the level below it, level 0 being
+// the full resolution layers
+void DownsampleRows(GameState *gs, u32 l, u32 y0, u32 y1)
+{
+  PyramidLevel *dst = &gs->pyramid[l];
+  PyramidLevel *src = &gs->pyramid[l - 1];
+  bool base = (l == 1);
+  u32 srcWidth = base ? gs->map_width : src->width;
+  u32 srcHeight = base ? gs->map_height : src->height;
+
+  for (u32 y = y0; y < y1; y++)
+  {
+    for (u32 x = 0; x < dst->width; x++)
+    {
+      f32 hmin = INFINITY, hmax = -INFINITY, hsum = 0.0f;
+      u32 smax = 0, ssum = 0;
+      u32 wmin = 255, wmax = 0, wsum = 0;
+      u32 fsum = 0;
+      u8 river = 0;
+      u8 biomes[4];
+      u32 open = 0;
+      u32 count = 0;
+
+      for (u32 sy = 2 * y; sy < min(2 * y + 2, srcHeight); sy++)
+      {
+        for (u32 sx = 2 * x; sx < min(2 * x + 2, srcWidth); sx++)
+        {
+          u32 i = sy * srcWidth + sx;
+          if (base)
+          {
+            hmin = min(hmin, gs->heightmap[i]);
+            hmax = max(hmax, gs->heightmap[i]);
+            hsum += gs->heightmap[i];
+            smax = max(smax, gs->slopemap[i]);
+            ssum += gs->slopemap[i];
+            wmin = min(wmin, (u32)gs->watermap[i]);
+            wmax = max(wmax, (u32)gs->watermap[i]);
+            wsum += gs->watermap[i];
+            fsum += (gs->forestmap[i] == 1) ? 255 : 0;
+            open += IsForestedOrWater(i, gs) ? 0 : 255;
+            river = max(river, gs->rivermap[i]);
+            biomes[count] = gs->biomemap[i];
+          }
+          else
+          {
+            hmin = min(hmin, src->height_min[i]);
+            hmax = max(hmax, src->height_max[i]);
+            hsum += src->height_avg[i];
+            smax = max(smax, src->slope_max[i]);
+            ssum += src->slope_avg[i];
+            wmin = min(wmin, (u32)src->water_min[i]);
+            wmax = max(wmax, (u32)src->water_max[i]);
+            wsum += src->water_avg[i];
+            fsum += src->forest_avg[i];
+            open += src->passable[i];
+            river = max(river, src->river_max[i]);
+            biomes[count] = src->biome[i];
+          }
+          count += 1;
+      } }
+
+      u32 d = y * dst->width + x;
+      dst->height_min[d] = hmin;
+      dst->height_max[d] = hmax;
+      dst->height_avg[d] = hsum / count;
+      dst->slope_max[d] = smax;
+      dst->slope_avg[d] = ssum / count;
+      dst->water_min[d] = wmin;
+      dst->water_max[d] = wmax;
+      dst->water_avg[d] = wsum / count;
+      dst->forest_avg[d] = fsum / count;
+      // rounded up, so a cell only reads 0 with no open ground under it
+      dst->passable[d] = (open + count - 1) / count;
+      dst->river_max[d] = river;
+      dst->biome[d] = DominantBiome(biomes, count);
+} } }
+
+// Each level needs the one below, the rows of a level are split over threads
+void BuildPyramid(GameState *gs)
+{
+  u32 threads = max(thread::hardware_concurrency(), 1u);
+  for (u32 l = 1; l <= gs->pyramid_levels; l++)
+  {
+    u32 rows = gs->pyramid[l].height;
+    u32 bands = min(threads, max(rows / 16, 1u));
+    vector<thread> workers;
+    for (u32 b = 1; b < bands; b++)
+    {
+      workers.push_back(thread(DownsampleRows, gs, l, rows * b / bands, rows * (b + 1) / bands));
+    }
+    DownsampleRows(gs, l, 0, rows / bands);
+    for (u32 b = 0; b < workers.size(); b++)
+    {
+      workers[b].join();
+} } }
+
+// Smallest level whose cells are still at least a pixel wide at this zoom
+u32 PyramidLevelForScale(GameState *gs, f32 scale)
+{
+  u32 level = 0;
+  while (level < gs->pyramid_levels && scale * (1 << (level + 1)) <= 1.0f)
+  {
+    level += 1;
+  }
+  return level;
+}
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include "typenames.h"
+
+// Seeded random numbers for world generation. rand() is left to the C
+// library, so the same seed could give a different island on another
+// platform; this is PCG32 (https://www.pcg-random.org/) and gives the same
+// sequence everywhere. Each generator draws from its own stream of the seed,
+// so adding draws to one doesn't shift the others.
+
+#define STREAM_HEIGHT      1
+#define STREAM_WATER       2
+#define STREAM_TEMPERATURE 3
+#define STREAM_SIMULATION  4 // agents and edits of --simulate, see simulation.h
+
+typedef struct Random
+{
+  u64 state;
+  u64 inc;
+} Random;
+
+u32 NextRandom(Random *r)
+{
+  u64 old = r->state;
+  r->state = old * 6364136223846793005ULL + r->inc;
+  u32 xorshifted = (u32)(((old >> 18) ^ old) >> 27);
+  u32 rot = (u32)(old >> 59);
+  return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+}
+
+void SeedRandom(Random *r, u64 seed, u64 stream)
+{
+  r->state = 0;
+  r->inc = (stream << 1) | 1;
+  NextRandom(r);
+  r->state += seed;
+  NextRandom(r);
+}
+
+// in [0, n), the modulo bias is negligible for the small n used here
+u32 RandomBelow(Random *r, u32 n)
+{
+  return NextRandom(r) % n;
+}
+
+#endif
@@ -0,0 +1,485 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <chrono>
+#include <mutex>
+#include <algorithm>
+
+#include "proc-gen.h"
+#include "astar.h"
+#include "path-smooth.h"
+#include "worker-pool.h"
+#include "latency.h"
+
+// Serves path queries on the generated world over a Unix domain socket,
+// `./proc-gen --serve path [--workers n]`. Clients send fixed size requests
+// and get each answer back tagged with the request's id, in any order.
+//
+// One thread does all the socket I/O. Every time it wakes it reads whatever
+// requests have arrived on all connections, up to SERVER_BATCH_MAX, and a
+// worker pool splits that batch. Each worker keeps its own view of the world
+// (see CreateWorldView) and they all share the world's path cache. A worker
+// sends each answer as soon as it has it, rather than when the batch is
+// done, and the I/O thread sends whatever the socket didn't take.
+//
+// Request, SERVER_REQUEST_SIZE bytes, little endian:
+//   u32 id       echoed in the response
+//   u32 world    the seed the server was started with
+//   u16 start_x, start_y, goal_x, goal_y
+//   u8  type     REQUEST_PATH or REQUEST_STATS
+//   u8  search   SEARCH_4DIR .. SEARCH_LAZY_THETA, flow fields aren't served
+//   u8  cost     COST_HEIGHT .. COST_BIOME
+//   u8  flags    REQUEST_LANDMARKS | REQUEST_BIDIRECTIONAL | REQUEST_WAYPOINTS
+//                Other bits, or a combination AStar() doesn't run as asked
+//                (see SearchSupported), get STATUS_BAD_REQUEST.
+//
+// Response, SERVER_RESPONSE_SIZE bytes then `count` u32s:
+//   u32 id
+//   u32 status   STATUS_*
+//   u32 count    path cells (y * width + x) from start to goal, only the
+//                smoothed waypoints with REQUEST_WAYPOINTS (see
+//                path-smooth.h), or for REQUEST_STATS the search then
+//                request latency histograms
+//   u32 expansions
+//   f64 cost
+
+#define SERVER_REQUEST_SIZE  20
+#define SERVER_RESPONSE_SIZE 24
+#define SERVER_BATCH_MAX     256
+#define SERVER_MAX_CLIENTS   64
+#define SERVER_POLL_MS       100
+
+#define REQUEST_PATH  0
+#define REQUEST_STATS 1
+
+#define REQUEST_LANDMARKS      1
+#define REQUEST_BIDIRECTIONAL  2
+#define REQUEST_WAYPOINTS      8
+#define REQUEST_FLAGS          (REQUEST_LANDMARKS | REQUEST_BIDIRECTIONAL | REQUEST_WAYPOINTS)
+
+#define STATUS_OK          0
+#define STATUS_NO_PATH     1
+#define STATUS_BAD_REQUEST 2
+#define STATUS_WRONG_WORLD 3
+
+using namespace std;
+
+#if defined(_WIN32)
+
+bool RunServer(GameState *, const char *, u32)
+{
+  printf("--serve needs Unix domain sockets, which this build doesn't have\n");
+  return false;
+}
+
+#else
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+u32 GetU32(const u8 *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((u32)p[3] << 24);
+}
+
+u16 GetU16(const u8 *p)
+{
+  return (u16)(p[0] | (p[1] << 8));
+}
+
+void PutU32(vector<u8> &out, u32 v)
+{
+  u8 bytes[4] = {(u8)v, (u8)(v >> 8), (u8)(v >> 16), (u8)(v >> 24)};
+  out.insert(out.end(), bytes, bytes + 4);
+}
+
+void PutF64(vector<u8> &out, f64 v)
+{
+  u64 bits;
+  memcpy(&bits, &v, 8);
+  PutU32(out, (u32)bits);
+  PutU32(out, (u32)(bits >> 32));
+}
+
+struct PathRequest
+{
+  u32 id;
+  u32 world;
+  u16 start_x, start_y, goal_x, goal_y;
+  u8 type;
+  u8 search;
+  u8 cost;
+  u8 flags;
+};
+
+PathRequest DecodeRequest(const u8 *p)
+{
+  PathRequest r;
+  r.id = GetU32(p);
+  r.world = GetU32(p + 4);
+  r.start_x = GetU16(p + 8);
+  r.start_y = GetU16(p + 10);
+  r.goal_x = GetU16(p + 12);
+  r.goal_y = GetU16(p + 14);
+  r.type = p[16];
+  r.search = p[17];
+  r.cost = p[18];
+  r.flags = p[19];
+  return r;
+}
+
+struct ServerClient
+{
+  i32 fd;
+  vector<u8> in;  // bytes of a request not complete yet
+  vector<u8> out; // responses the socket hasn't taken yet
+  bool closed;
+  mutex lock;     // out and closed, while a batch's workers answer
+};
+
+// A request of the current batch and its answer. The batch's jobs are
+// reused, so the path vectors keep their capacity.
+struct ServerJob
+{
+  ServerClient *client;
+  PathRequest request;
+  chrono::steady_clock::time_point received;
+  u32 status;
+  u32 expansions;
+  f64 cost;
+  vector<u32> path;
+};
+
+struct ServerWorker
+{
+  GameState *view;
+  LatencyHistogram search;
+  LatencyHistogram request; // received to sent, batching included
+};
+
+struct Server
+{
+  GameState *gs;
+  WorkerPool pool;
+  vector<ServerWorker *> workers;
+  vector<ServerJob> jobs;
+  u32 job_count;
+};
+
+volatile sig_atomic_t SERVER_STOP = 0;
+
+void StopServer(int)
+{
+  SERVER_STOP = 1;
+}
+
+bool InBounds(GameState *gs, u16 x, u16 y)
+{
+  return x < gs->map_width && y < gs->map_height;
+}
+
+void AnswerJob(ServerJob *job, GameState *view)
+{
+  const PathRequest *r = &job->request;
+  job->path.clear();
+  job->expansions = 0;
+  job->cost = INFINITY;
+  if (r->type != REQUEST_PATH)
+  {
+    job->status = STATUS_BAD_REQUEST;
+    return;
+  }
+  if (r->world != view->seed)
+  {
+    job->status = STATUS_WRONG_WORLD;
+    return;
+  }
+  if (r->search > SEARCH_LAZY_THETA || r->cost > COST_BIOME || (r->flags & ~REQUEST_FLAGS)
+    || !InBounds(view, r->start_x, r->start_y) || !InBounds(view, r->goal_x, r->goal_y))
+  {
+    job->status = STATUS_BAD_REQUEST;
+    return;
+  }
+
+  view->search_mode = r->search;
+  view->cost_model = r->cost;
+  view->use_landmarks = (r->flags & REQUEST_LANDMARKS) != 0;
+  view->bidirectional = (r->flags & REQUEST_BIDIRECTIONAL) != 0;
+  view->player_pos = /*(Vector2)*/{(f32)r->start_x, (f32)r->start_y};
+  view->target_pos = /*(Vector2)*/{(f32)r->goal_x, (f32)r->goal_y};
+  if (!SearchSupported(view))
+  {
+    job->status = STATUS_BAD_REQUEST;
+    return;
+  }
+  AStar(view);
+
+  job->expansions = view->search_expansions;
+  job->status = view->path->empty() ? STATUS_NO_PATH : STATUS_OK;
+  if (job->status == STATUS_OK) job->cost = view->path_cost;
+  if (r->flags & REQUEST_WAYPOINTS)
+  {
+    SmoothPath(view);
+    job->path.assign(view->waypoints.begin(), view->waypoints.end());
+  }
+  else
+  {
+    job->path.assign(view->path->begin(), view->path->end());
+  }
+}
+
+void QueueResponse(ServerClient *c, u32 id, u32 status, const u32 *cells, u32 count,
+  u32 expansions, f64 cost)
+{
+  PutU32(c->out, id);
+  PutU32(c->out, status);
+  PutU32(c->out, count);
+  PutU32(c->out, expansions);
+  PutF64(c->out, cost);
+  for (u32 i = 0; i < count; i++)
+  {
+    PutU32(c->out, cells[i]);
+} }
+
+// Adds up every worker's histograms
+void MergeWorkers(Server *server, LatencyHistogram *search, LatencyHistogram *request)
+{
+  ClearHistogram(search);
+  ClearHistogram(request);
+  for (u32 w = 0; w < server->workers.size(); w++)
+  {
+    MergeHistogram(search, &server->workers[w]->search);
+    MergeHistogram(request, &server->workers[w]->request);
+} }
+
+// Both histograms' buckets, search first, saturated to u32
+void QueueStats(Server *server, ServerClient *c, u32 id)
+{
+  LatencyHistogram search, request;
+  MergeWorkers(server, &search, &request);
+  u32 buckets[2 * LATENCY_BUCKETS];
+  for (u32 b = 0; b < LATENCY_BUCKETS; b++)
+  {
+    buckets[b] = (u32)min(search.buckets[b], (u64)0xFFFFFFFFu);
+    buckets[LATENCY_BUCKETS + b] = (u32)min(request.buckets[b], (u64)0xFFFFFFFFu);
+  }
+  QueueResponse(c, id, STATUS_OK, buckets, 2 * LATENCY_BUCKETS, 0, 0.0);
+}
+
+// Sends what the socket takes without blocking
+void FlushClient(ServerClient *c)
+{
+  size_t sent = 0;
+  while (sent < c->out.size())
+  {
+    ssize_t n = send(c->fd, &c->out[sent], c->out.size() - sent, MSG_NOSIGNAL);
+    if (n > 0)
+    {
+      sent += n;
+      continue;
+    }
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+    c->closed = true;
+    break;
+  }
+  c->out.erase(c->out.begin(), c->out.begin() + sent);
+}
+
+// Answers one job of the batch on a pool worker and sends the answer
+void RunJob(void *context, u32 worker, u32 index)
+{
+  Server *server = (Server *)context;
+  ServerWorker *w = server->workers[worker];
+  ServerJob *job = &server->jobs[index];
+  chrono::steady_clock::time_point t = chrono::steady_clock::now();
+  AnswerJob(job, w->view);
+  AddLatency(&w->search, chrono::duration<f64, micro>(chrono::steady_clock::now() - t).count());
+
+  ServerClient *c = job->client;
+  lock_guard<mutex> guard(c->lock);
+  QueueResponse(c, job->request.id, job->status,
+    job->path.empty() ? NULL : &job->path[0], job->path.size(), job->expansions, job->cost);
+  if (!c->closed) FlushClient(c);
+  AddLatency(&w->request, chrono::duration<f64, micro>(chrono::steady_clock::now() - job->received).count());
+}
+
+// Reads what has arrived and queues the complete requests, path queries
+// become jobs of the next batch. Stops reading once the batch is full, the
+// rest wait in the socket.
+void ReadClient(Server *server, ServerClient *c)
+{
+  u8 buffer[SERVER_REQUEST_SIZE * 64];
+  while (server->job_count < SERVER_BATCH_MAX)
+  {
+    ssize_t n = recv(c->fd, buffer, sizeof(buffer), 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+    if (n <= 0)
+    {
+      c->closed = true;
+      break;
+    }
+    c->in.insert(c->in.end(), buffer, buffer + n);
+
+    size_t used = 0;
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    for (; used + SERVER_REQUEST_SIZE <= c->in.size(); used += SERVER_REQUEST_SIZE)
+    {
+      PathRequest r = DecodeRequest(&c->in[used]);
+      if (r.type == REQUEST_STATS)
+      {
+        QueueStats(server, c, r.id);
+        continue;
+      }
+      if (server->job_count == server->jobs.size()) server->jobs.push_back(ServerJob());
+      ServerJob *job = &server->jobs[server->job_count++];
+      job->client = c;
+      job->request = r;
+      job->received = now;
+    }
+    c->in.erase(c->in.begin(), c->in.begin() + used);
+} }
+
+i32 ListenOn(const char *path)
+{
+  sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(address.sun_path))
+  {
+    printf("Socket path too long: %s\n", path);
+    return -1;
+  }
+  strcpy(address.sun_path, path);
+
+  i32 fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+  unlink(path); // a socket left by a server that didn't stop cleanly
+  if (bind(fd, (sockaddr *)&address, sizeof(address)) != 0 || listen(fd, SERVER_MAX_CLIENTS) != 0)
+  {
+    printf("Can't listen on %s: %s\n", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  return fd;
+}
+
+// Serves until SIGINT or SIGTERM, then prints the latency histograms
+bool RunServer(GameState *gs, const char *path, u32 workers)
+{
+  i32 listener = ListenOn(path);
+  if (listener < 0) return false;
+  signal(SIGINT, StopServer);
+  signal(SIGTERM, StopServer);
+  signal(SIGPIPE, SIG_IGN);
+
+  Server *server = new Server();
+  server->gs = gs;
+  server->job_count = 0;
+  workers = max(workers, 1u);
+  for (u32 w = 0; w < workers; w++)
+  {
+    ServerWorker *worker = new ServerWorker();
+    worker->view = CreateWorldView(gs);
+    ClearHistogram(&worker->search);
+    ClearHistogram(&worker->request);
+    server->workers.push_back(worker);
+  }
+  StartWorkerPool(&server->pool, workers);
+  printf("Serving %ux%u world %u on %s with %u workers\n",
+    gs->map_width, gs->map_height, gs->seed, path, workers);
+  fflush(stdout);
+
+  vector<ServerClient *> clients;
+  vector<pollfd> fds;
+  u64 batches = 0;
+  while (!SERVER_STOP)
+  {
+    fds.clear();
+    pollfd listen_fd = {listener, POLLIN, 0};
+    fds.push_back(listen_fd);
+    for (u32 c = 0; c < clients.size(); c++)
+    {
+      pollfd client_fd = {clients[c]->fd, (short)(POLLIN | (clients[c]->out.empty() ? 0 : POLLOUT)), 0};
+      fds.push_back(client_fd);
+    }
+    if (poll(&fds[0], fds.size(), SERVER_POLL_MS) < 0 && errno != EINTR) break;
+
+    if ((fds[0].revents & POLLIN) && clients.size() < SERVER_MAX_CLIENTS)
+    {
+      i32 fd = accept(listener, NULL, NULL);
+      if (fd >= 0)
+      {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        ServerClient *c = new ServerClient();
+        c->fd = fd;
+        c->closed = false;
+        clients.push_back(c);
+    } }
+
+    // the batch is whatever has arrived on every connection
+    server->job_count = 0;
+    for (u32 c = 0; c + 1 < fds.size(); c++)
+    {
+      if (fds[c + 1].revents & (POLLIN | POLLHUP | POLLERR)) ReadClient(server, clients[c]);
+    }
+    if (server->job_count > 0)
+    {
+      RunWorkerPool(&server->pool, server->job_count, RunJob, server);
+      batches += 1;
+    }
+
+    for (u32 c = 0; c < clients.size(); )
+    {
+      if (!clients[c]->out.empty() && !clients[c]->closed) FlushClient(clients[c]);
+      if (clients[c]->closed)
+      {
+        close(clients[c]->fd);
+        delete clients[c];
+        clients.erase(clients.begin() + c);
+        continue;
+      }
+      c++;
+  } }
+
+  StopWorkerPool(&server->pool);
+  LatencyHistogram search, request;
+  MergeWorkers(server, &search, &request);
+  for (u32 w = 0; w < server->workers.size(); w++)
+  {
+    DestroyWorldView(server->workers[w]->view);
+    delete server->workers[w];
+  }
+  for (u32 c = 0; c < clients.size(); c++)
+  {
+    close(clients[c]->fd);
+    delete clients[c];
+  }
+  close(listener);
+  unlink(path);
+
+  printf("\n%llu batches, %.1f requests per batch\n", (unsigned long long)batches,
+    batches ? request.count / (f64)batches : 0.0);
+  PrintHistogram("Search", &search);
+  PrintHistogram("Request", &request);
+  delete server;
+  return true;
+}
+
+#endif
+
+#endif
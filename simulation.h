@@ -0,0 +1,319 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <stdio.h>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#if defined(__linux__)
+#include <sys/resource.h>
+#endif
+
+#include "proc-gen.h"
+#include "random.h"
+#include "astar.h"
+#include "path-smooth.h"
+#include "worker-pool.h"
+#include "latency.h"
+#include "layer-hash.h"
+#include "benchmark.h"
+
+// Headless crowd on the generated island, `./proc-gen --simulate [agents]
+// [--ticks n] [--edit-every n] [--workers n]`. Every tick each agent walks
+// one cell along its waypoints, the way the window's agent does. Agents that
+// arrive, or whose goal turns out unreachable, get a new random goal; every
+// edit_every ticks a forest brush is planted on the island (and cleared
+// again by the next edit) and the agents whose route crosses it replan. The
+// tick's plans run as one batch on a worker pool, 8-dir ALT searches on the
+// height cost with the path cache off, since random goals never repeat.
+//
+// Goals and edits come from the seed and are drawn on one thread, so a run
+// ends in the same state, whatever the worker count; the final state hash
+// checks that.
+
+#define SIM_REPORTS 10     // progress lines per run
+#define SIM_EDIT_RADIUS 4
+
+using namespace std;
+
+// defined in proc-gen.cpp
+void EditTerrain(GameState *gs, i32 x, i32 y, i32 radius, u8 forest);
+
+struct Simulation
+{
+  GameState *gs;
+  WorkerPool pool;
+  vector<GameState *> views;      // one per worker
+  vector<LatencyHistogram> latency; // per worker, queries since the last progress line
+  vector<u64> found;              // per worker
+  Random random;
+  vector<i32> land;               // cells agents start on and head for, see LargestLandRegion()
+
+  // agents, struct of arrays
+  u32 agents;
+  vector<i32> position;
+  vector<i32> goal;
+  vector<i32> anchor;             // waypoint walked away from
+  vector<u32> waypoint;           // index of the waypoint walked to
+  vector<u32> step;               // cells walked along the segment
+  vector<vector<i32> > paths;     // waypoints, see path-smooth.h
+  vector<u8> replan;              // 1 plans to the same goal, 2 to a new one
+  vector<u32> planning;           // agents planned this tick
+};
+
+// Plans one agent of the tick's batch, on a pool worker
+void PlanAgent(void *context, u32 worker, u32 index)
+{
+  Simulation *sim = (Simulation *)context;
+  GameState *view = sim->views[worker];
+  u32 a = sim->planning[index];
+  u32 width = view->map_width;
+  view->player_pos = /*(Vector2)*/{(f32)(sim->position[a] % width), (f32)(sim->position[a] / width)};
+  view->target_pos = /*(Vector2)*/{(f32)(sim->goal[a] % width), (f32)(sim->goal[a] / width)};
+
+  chrono::steady_clock::time_point t = chrono::steady_clock::now();
+  AStar(view);
+  SmoothPath(view);
+  AddLatency(&sim->latency[worker], MillisecondsSince(t) * 1000.0);
+
+  sim->paths[a] = view->waypoints;
+  sim->anchor[a] = sim->position[a];
+  sim->waypoint[a] = 1;
+  sim->step[a] = 0;
+  sim->found[worker] += !view->waypoints.empty();
+}
+
+i32 RandomLandCell(Simulation *sim)
+{
+  return sim->land[RandomBelow(&sim->random, sim->land.size())];
+}
+
+// Walks an agent one cell, true once it has arrived or has no path
+bool MoveAgent(Simulation *sim, u32 a)
+{
+  const vector<i32> &path = sim->paths[a];
+  if (sim->waypoint[a] >= path.size()) return true;
+  u32 width = sim->gs->map_width;
+  i32 next = path[sim->waypoint[a]];
+  sim->step[a] += 1;
+  sim->position[a] = LineCell(sim->anchor[a] % width, sim->anchor[a] / width,
+    next % width, next / width, sim->step[a], width);
+  if (sim->position[a] == next)
+  {
+    sim->anchor[a] = next;
+    sim->step[a] = 0;
+    sim->waypoint[a] += 1;
+  }
+  return sim->waypoint[a] >= path.size();
+}
+
+// True when the rest of an agent's route comes near the rectangle, going by
+// each segment's bounding box
+bool RouteCrosses(Simulation *sim, u32 a, DirtyRect rect)
+{
+  u32 width = sim->gs->map_width;
+  const vector<i32> &path = sim->paths[a];
+  i32 from = sim->position[a];
+  for (u32 w = sim->waypoint[a]; w < path.size(); w++)
+  {
+    i32 to = path[w];
+    i32 x0 = min(from % width, to % width), x1 = max(from % width, to % width);
+    i32 y0 = min(from / width, to / width), y1 = max(from / width, to / width);
+    if (x0 <= rect.x1 + 1 && x1 >= rect.x0 - 1 && y0 <= rect.y1 + 1 && y1 >= rect.y0 - 1) return true;
+    from = to;
+  }
+  return false;
+}
+
+size_t SimulationBytes(Simulation *sim)
+{
+  size_t bytes = sim->agents * (4 * sizeof(i32) + sizeof(u32) + sizeof(u8) + sizeof(vector<i32>));
+  for (u32 a = 0; a < sim->agents; a++)
+  {
+    bytes += sim->paths[a].capacity() * sizeof(i32);
+  }
+  return bytes + sim->latency.size() * sizeof(LatencyHistogram);
+}
+
+void RunSimulation(GameState *gs, u32 agents, u32 ticks, u32 edit_every, u32 workers)
+{
+  Simulation *sim = new Simulation();
+  sim->gs = gs;
+  sim->agents = agents;
+  SeedRandom(&sim->random, gs->seed, STREAM_SIMULATION);
+  sim->land = LargestLandRegion(gs);
+  if (sim->land.empty() || agents == 0)
+  {
+    printf("Nothing to simulate\n");
+    delete sim;
+    return;
+  }
+
+  gs->search_mode = SEARCH_8DIR;
+  gs->cost_model = COST_HEIGHT;
+  gs->use_landmarks = true;
+  gs->bidirectional = false;
+  gs->use_path_cache = false;
+  workers = max(workers, 1u);
+  for (u32 w = 0; w < workers; w++)
+  {
+    GameState *view = CreateWorldView(gs);
+    view->search_mode = gs->search_mode;
+    view->cost_model = gs->cost_model;
+    view->use_landmarks = gs->use_landmarks;
+    view->bidirectional = gs->bidirectional;
+    sim->views.push_back(view);
+  }
+  sim->latency.resize(workers);
+  for (u32 w = 0; w < workers; w++)
+  {
+    ClearHistogram(&sim->latency[w]);
+  }
+  sim->found.assign(workers, 0);
+  StartWorkerPool(&sim->pool, workers);
+
+  sim->position.resize(agents);
+  sim->goal.resize(agents);
+  sim->anchor.resize(agents);
+  sim->waypoint.assign(agents, 0);
+  sim->step.assign(agents, 0);
+  sim->paths.resize(agents);
+  sim->replan.assign(agents, 1);
+  for (u32 a = 0; a < agents; a++)
+  {
+    sim->position[a] = RandomLandCell(sim);
+  }
+
+  printf("Simulating %u agents on %ux%u world %u for %u ticks, %u workers, an edit every %u ticks\n",
+    agents, gs->map_width, gs->map_height, gs->seed, ticks, workers, edit_every);
+  // every column covers the ticks since the previous line, the latencies are
+  // the upper ends of their histogram buckets
+  printf("%10s %10s %12s %12s %10s %10s\n", "tick", "ticks/s", "queries", "queries/s", "p50 < us", "p99 < us");
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  chrono::steady_clock::time_point interval = start;
+  f64 plan_ms = 0.0;
+  f64 edit_ms = 0.0;
+  u64 queries = 0;
+  u64 interval_queries = 0;
+  u64 moves = 0;
+  u32 edits = 0;
+  i32 edit_center = 0;
+  u32 report_every = max(ticks / SIM_REPORTS, 1u);
+  u32 reported = 0;
+  LatencyHistogram latency;
+  LatencyHistogram total_latency;
+  ClearHistogram(&total_latency);
+  for (u32 tick = 1; tick <= ticks; tick++)
+  {
+    // plant a brush, the next edit clears it again
+    if (edit_every > 0 && tick % edit_every == 0)
+    {
+      chrono::steady_clock::time_point t = chrono::steady_clock::now();
+      bool plant = (edits % 2 == 0);
+      if (plant) edit_center = RandomLandCell(sim);
+      i32 x = edit_center % (i32)gs->map_width;
+      i32 y = edit_center / (i32)gs->map_width;
+      EditTerrain(gs, x, y, SIM_EDIT_RADIUS, plant ? 1 : 0);
+      // the rectangle EditTerrain() changed
+      DirtyRect rect;
+      rect.x0 = max(x - SIM_EDIT_RADIUS, 0);
+      rect.y0 = max(y - SIM_EDIT_RADIUS, 0);
+      rect.x1 = min(x + SIM_EDIT_RADIUS, (i32)gs->map_width - 1);
+      rect.y1 = min(y + SIM_EDIT_RADIUS, (i32)gs->map_height - 1);
+      for (u32 w = 0; w < workers; w++)
+      {
+        ShareWorld(sim->views[w], gs);
+      }
+      for (u32 a = 0; a < agents; a++)
+      {
+        if (!sim->replan[a] && RouteCrosses(sim, a, rect)) sim->replan[a] = 1;
+      }
+      edits += 1;
+      edit_ms += MillisecondsSince(t);
+    }
+
+    // walk, then hand out goals to whoever needs one
+    sim->planning.clear();
+    for (u32 a = 0; a < agents; a++)
+    {
+      if (!sim->replan[a])
+      {
+        bool arrived = MoveAgent(sim, a);
+        moves += 1;
+        // no path means the goal is unreachable, pick another
+        if (arrived) sim->replan[a] = 2;
+      }
+      if (sim->replan[a])
+      {
+        if (sim->replan[a] == 2 || sim->paths[a].empty() || sim->goal[a] == sim->position[a])
+        {
+          sim->goal[a] = RandomLandCell(sim);
+        }
+        sim->replan[a] = 0;
+        sim->planning.push_back(a);
+    } }
+
+    chrono::steady_clock::time_point t = chrono::steady_clock::now();
+    RunWorkerPool(&sim->pool, sim->planning.size(), PlanAgent, sim);
+    plan_ms += MillisecondsSince(t);
+    queries += sim->planning.size();
+    interval_queries += sim->planning.size();
+
+    if (tick % report_every == 0 || tick == ticks)
+    {
+      ClearHistogram(&latency);
+      for (u32 w = 0; w < workers; w++)
+      {
+        MergeHistogram(&latency, &sim->latency[w]);
+        ClearHistogram(&sim->latency[w]);
+      }
+      MergeHistogram(&total_latency, &latency);
+      f64 seconds = MillisecondsSince(interval) / 1000.0;
+      printf("%10u %10.1f %12llu %12.0f %10.0f %10.0f\n", tick, (tick - reported) / seconds,
+        (unsigned long long)interval_queries, interval_queries / seconds,
+        HistogramPercentile(&latency, 0.5), HistogramPercentile(&latency, 0.99));
+      interval = chrono::steady_clock::now();
+      interval_queries = 0;
+      reported = tick;
+  } }
+  f64 seconds = MillisecondsSince(start) / 1000.0;
+
+  u64 found = 0;
+  for (u32 w = 0; w < workers; w++)
+  {
+    found += sim->found[w];
+  }
+  StopWorkerPool(&sim->pool);
+
+  u64 hash = HashBytes(&sim->position[0], agents * sizeof(i32), FNV_OFFSET);
+  hash = HashBytes(&sim->goal[0], agents * sizeof(i32), hash);
+  size_t cells = gs->map_width * gs->map_height;
+  // GridSearch's from, pathCost, seen and closed for each worker
+  size_t workspace = workers * cells * (sizeof(i32) + sizeof(f64) + 2 * sizeof(u32));
+  printf("\n%u ticks in %.2f s: %.1f ticks/s, %llu agent moves\n", ticks, seconds, ticks / seconds,
+    (unsigned long long)moves);
+  printf("%llu queries (%llu found): %.0f queries/s of run time, %.0f of planning time, "
+    "p50 < %.0f us, p99 < %.0f us, mean %.1f us\n", (unsigned long long)queries, (unsigned long long)found,
+    queries / seconds, queries / (plan_ms / 1000.0), HistogramPercentile(&total_latency, 0.5),
+    HistogramPercentile(&total_latency, 0.99), total_latency.count ? total_latency.total_us / total_latency.count : 0.0);
+  printf("%u edits, %.2f ms each with the pyramid and landmarks rebuilt\n", edits, edits ? edit_ms / edits : 0.0);
+  printf("Memory: agents %.1f MB, world %.1f MB, search workspaces %.1f MB",
+    SimulationBytes(sim) / (1024.0 * 1024.0), gs->arena.capacity / (1024.0 * 1024.0),
+    workspace / (1024.0 * 1024.0));
+#if defined(__linux__)
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  printf(", peak resident %.1f MB", usage.ru_maxrss / 1024.0);
+#endif
+  printf("\nState hash: 0x%016llx\n", (unsigned long long)hash);
+
+  for (u32 w = 0; w < workers; w++)
+  {
+    DestroyWorldView(sim->views[w]);
+  }
+  delete sim;
+}
+
+#endif
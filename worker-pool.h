@@ -0,0 +1,114 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "typenames.h"
+
+// Threads that stay up between batches of work, so whatever they keep in
+// thread_local storage (the search workspaces, see RunGridSearch) is
+// allocated once. The calling thread works on each batch as worker 0.
+
+using namespace std;
+
+// Does item `index` of a batch on worker `worker`
+typedef void (*PoolJob)(void *context, u32 worker, u32 index);
+
+struct WorkerPool
+{
+  vector<thread> threads;
+
+  // a batch is handed out by bumping `batch`, workers take items from `next`
+  // and the last one done wakes the caller
+  mutex lock;
+  condition_variable start;
+  condition_variable done;
+  u64 batch;
+  u32 busy;
+  bool stopping;
+  atomic<u32> next;
+
+  PoolJob job;
+  void *context;
+  u32 count;
+};
+
+void RunPoolItems(WorkerPool *pool, u32 worker)
+{
+  for (u32 i = pool->next++; i < pool->count; i = pool->next++)
+  {
+    pool->job(pool->context, worker, i);
+} }
+
+void PoolWorkerLoop(WorkerPool *pool, u32 worker)
+{
+  u64 seen = 0;
+  for (;;)
+  {
+    {
+      unique_lock<mutex> guard(pool->lock);
+      pool->start.wait(guard, [&]{ return pool->stopping || pool->batch != seen; });
+      if (pool->stopping) return;
+      seen = pool->batch;
+    }
+    RunPoolItems(pool, worker);
+    lock_guard<mutex> guard(pool->lock);
+    pool->busy -= 1;
+    if (pool->busy == 0) pool->done.notify_one();
+} }
+
+// Starts workers 1 to workers - 1
+void StartWorkerPool(WorkerPool *pool, u32 workers)
+{
+  pool->batch = 0;
+  pool->busy = 0;
+  pool->stopping = false;
+  pool->count = 0;
+  for (u32 w = 1; w < workers; w++)
+  {
+    pool->threads.push_back(thread(PoolWorkerLoop, pool, w));
+} }
+
+u32 PoolWorkers(WorkerPool *pool)
+{
+  return pool->threads.size() + 1;
+}
+
+// Runs job(context, worker, i) for every i in [0, count), returns when all
+// are done
+void RunWorkerPool(WorkerPool *pool, u32 count, PoolJob job, void *context)
+{
+  pool->job = job;
+  pool->context = context;
+  pool->count = count;
+  pool->next = 0;
+  {
+    lock_guard<mutex> guard(pool->lock);
+    pool->busy = pool->threads.size();
+    pool->batch += 1;
+  }
+  pool->start.notify_all();
+  RunPoolItems(pool, 0);
+  unique_lock<mutex> guard(pool->lock);
+  pool->done.wait(guard, [&]{ return pool->busy == 0; });
+}
+
+void StopWorkerPool(WorkerPool *pool)
+{
+  {
+    lock_guard<mutex> guard(pool->lock);
+    pool->stopping = true;
+  }
+  pool->start.notify_all();
+  for (u32 t = 0; t < pool->threads.size(); t++)
+  {
+    pool->threads[t].join();
+  }
+  pool->threads.clear();
+}
+
+#endif
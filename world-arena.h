@@ -0,0 +1,80 @@
+#ifndef WORLD_ARENA_H
+#define WORLD_ARENA_H
+
+#include <stdlib.h>
+#include <stddef.h>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+#include "typenames.h"
+
+// One block of memory holding every per cell layer of a world. Layers start
+// on their own cache line so they can be read with aligned SIMD loads, the
+// block is freed with its owner and kept for the next world that fits.
+
+#define ARENA_ALIGN     64
+#define HUGE_PAGE_SIZE  (2 * 1024 * 1024)
+
+size_t AlignUp(size_t n, size_t align)
+{
+  return (n + align - 1) & ~(align - 1);
+}
+
+void *AlignedAlloc(size_t size, size_t align)
+{
+#if defined(_WIN32)
+  return _aligned_malloc(size, align);
+#else
+  void *block = NULL;
+  if (posix_memalign(&block, align, size) != 0) return NULL;
+  return block;
+#endif
+}
+
+void AlignedFree(void *block)
+{
+#if defined(_WIN32)
+  _aligned_free(block);
+#else
+  free(block);
+#endif
+}
+
+struct WorldArena
+{
+  u8 *base;
+  size_t capacity;
+
+  WorldArena() : base(NULL), capacity(0) {}
+  ~WorldArena() { AlignedFree(base); }
+  WorldArena(const WorldArena &) = delete;
+  WorldArena &operator=(const WorldArena &) = delete;
+
+  // Returns a block of at least `size` bytes, the contents are not kept when
+  // it has to grow. Big worlds are rounded to whole huge pages and, on Linux,
+  // offered to transparent huge pages to spare TLB misses on full map passes.
+  u8 *Reserve(size_t size)
+  {
+    if (size <= capacity) return base;
+
+    AlignedFree(base);
+    size_t align = ARENA_ALIGN;
+    if (size >= HUGE_PAGE_SIZE)
+    {
+      align = HUGE_PAGE_SIZE;
+      size = AlignUp(size, HUGE_PAGE_SIZE);
+    }
+    base = (u8 *)AlignedAlloc(size, align);
+    capacity = base ? size : 0;
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (base && align == HUGE_PAGE_SIZE) madvise(base, size, MADV_HUGEPAGE);
+#endif
+    return base;
+  }
+};
+
+#endif